@@ -111,7 +111,6 @@ expression
     | expression op=('*'|'/') expression              # MulDivExpr
     | expression op=('+'|'-') expression              # AddSubExpr
     | expression op=('=='|'!='|'<'|'>'|'<='|'>=') expression # CompareExpr
-    | expression '=' expression                        # AssignExpr
     | IDENTIFIER                                       # VarExpr
     | literal                                          # LiteralExpr
     | 'new' typeSpec                                   # NewExpr
@@ -126,6 +125,7 @@ expression
     | expression '--'                                  # PostDecrementExpr
     | '++' expression                                  # PreIncrementExpr
     | '--' expression                                  # PreDecrementExpr
+    | <assoc=right> expression '=' expression          # AssignExpr
     ;
 
 initializerList
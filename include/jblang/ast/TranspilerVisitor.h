@@ -6,6 +6,8 @@
 #include "jblang/types/SymbolTable.h"
 #include <string>
 #include <sstream>
+#include <map>
+#include <set>
 #include <unordered_map>
 #include <vector>
 #include <memory>
@@ -81,7 +83,14 @@ public:
     Type getClassFromCode(JBLangParser::ClassDeclContext* ctx);
     std::string generateParentConstructorCall(JBLangParser::ClassConstructorContext* ctx, const std::string& className);
     std::string resolveFieldAccess(const std::string& fieldName, const std::string& className);
+    bool resolveMemberType(const std::string& expr, Type& type);
+    bool lookupCountedPointer(const std::string& expr, Variable& var);
+    bool isHeapSlot(JBLangParser::ExpressionContext* target);
     Type getArrayFromCode(JBLangParser::ArrayDeclContext* ctx);
+    void findEscapingNames(antlr4::tree::ParseTree* tree, std::set<std::string>& names);
+    void findNames(antlr4::tree::ParseTree* tree, std::set<std::string>& names);
+    void releaseLocal(const std::string& name, const std::string& indentLevel);
+    std::vector<GlobalRoot> getGlobalRoots() const;
     std::vector<std::string> getClassNames() const;
     void generateClassMethodBodies();
 
@@ -95,5 +104,8 @@ private:
     int m_tempVarCounter;
     bool addRefCounts;
     std::vector<std::string> m_classNames;
+    // Locals an enclosing block leaves a nested one to release, as they die
+    // somewhere on its path.
+    std::map<JBLangParser::BlockContext*, std::vector<std::string>> m_handedDown;
     Type resolveTypeFromContext(JBLangParser::TypeSpecContext* ctx);
 };
\ No newline at end of file
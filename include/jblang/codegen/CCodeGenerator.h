@@ -5,8 +5,12 @@
 
 class CCodeGenerator : public CodeGenerator {
 public:
-    explicit CCodeGenerator(bool useRefCounts) noexcept
-            :m_useRefCounts(useRefCounts) { }
+    // With deferLocalRefCounts, only references held in the heap are counted,
+    // and the runtime finds those held by locals by scanning the stack.
+    explicit CCodeGenerator(bool useRefCounts, bool useWriteBarriers = false,
+            bool useTypeDescriptors = false, bool deferLocalRefCounts = false) noexcept
+            :m_useRefCounts(useRefCounts), m_useWriteBarriers(useWriteBarriers),
+             m_useTypeDescriptors(useTypeDescriptors), m_deferLocalRefCounts(useRefCounts && deferLocalRefCounts) { }
 
     ~CCodeGenerator() override = default;
 
@@ -21,13 +25,24 @@ public:
     std::string generateReturn(const std::string& value, const Type& type) override;
     std::string generateScopeEntry() override;
     std::string generateScopeExit(const std::map<std::string, Variable>& scopeVars) override;
-    std::string generateIncRef(const Variable& var, const std::string& other = "NULL") override;
-    std::string generateDecRef(const Variable& var) override;
+    std::string generateIncRef(const Variable& var, const std::string& other = "NULL",
+            bool heapSlot = false) override;
+    std::string generateDecRef(const Variable& var, bool heapSlot = false) override;
+    std::string generateStoreRef(const std::string& field, const std::string& object) override;
+    std::string generateWriteBarrier(const std::string& field, const std::string& value) override;
+    std::string generateTypeDescriptor(const std::string& typeName,
+            const std::vector<std::string>& pointerFields, const std::vector<std::string>& countedFields = {}) override;
     std::string generateAlloc(const Type& type) override;
+    std::string generateRootTable(const std::vector<GlobalRoot>& roots) override;
+    std::string generateRootRegistration(const std::vector<GlobalRoot>& roots) override;
+    std::string generateRuntimeSetup() override;
     std::string generateCast(const std::string& expr, const Type& fromType, const Type& toType) override;
 
 private:
     const bool m_useRefCounts;
+    const bool m_useWriteBarriers;
+    const bool m_useTypeDescriptors;
+    const bool m_deferLocalRefCounts;
 };
 
 #endif //CCODEGENERATOR_H
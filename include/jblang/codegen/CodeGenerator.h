@@ -8,6 +8,14 @@
 #include "jblang/types/TypeSystem.h"
 #include "jblang/types/SymbolTable.h"
 
+// A global the collector has to scan. pointerOffsets are C offset
+// expressions within it; when empty, it holds pointerCount pointers in a row.
+struct GlobalRoot {
+  std::string name;
+  size_t pointerCount = 0;
+  std::vector<std::string> pointerOffsets;
+};
+
 class CodeGenerator {
 public:
     CodeGenerator() = default;
@@ -29,9 +37,33 @@ public:
     virtual std::string generateReturn(const std::string& value, const Type& type) = 0;
     virtual std::string generateScopeEntry() = 0;
     virtual std::string generateScopeExit(const std::map<std::string, Variable>& scopeVars) = 0;
-    virtual std::string generateIncRef(const Variable& var, const std::string& other = "NULL") = 0;
-    virtual std::string generateDecRef(const Variable& var) = 0;
+    // heapSlot tells a reference held by a heap object, such as a field
+    // reached through a pointer, from one held by a local or a global.
+    virtual std::string generateIncRef(const Variable& var, const std::string& other = "NULL",
+            bool heapSlot = false) = 0;
+    virtual std::string generateDecRef(const Variable& var, bool heapSlot = false) = 0;
+    // When only heap references are counted, a pointer stored into field of
+    // object that came from anything but a variable, such as a call, has no
+    // count yet. This is the expression that gives it one, run after the
+    // store; empty when nothing is needed.
+    virtual std::string generateStoreRef(const std::string& field, const std::string& object) = 0;
+    // Emitted before a pointer is stored into a heap field. field is the
+    // destination lvalue (empty if there is none yet) and value the stored
+    // pointer, or "NULL" when it can't be evaluated twice safely.
+    virtual std::string generateWriteBarrier(const std::string& field, const std::string& value) = 0;
+    // Emitted after a struct or class definition for collectors that trace
+    // the heap precisely. pointerFields are the member paths of its pointers;
+    // countedFields, those of them released when a counted object is freed.
+    virtual std::string generateTypeDescriptor(const std::string& typeName,
+            const std::vector<std::string>& pointerFields, const std::vector<std::string>& countedFields = {}) = 0;
     virtual std::string generateAlloc(const Type& type) = 0;
+    // A static table of every global holding pointers, and the statement in
+    // main that registers it.
+    virtual std::string generateRootTable(const std::vector<GlobalRoot>& roots) = 0;
+    virtual std::string generateRootRegistration(const std::vector<GlobalRoot>& roots) = 0;
+    // Statements main runs just after runtime_init to put the collector in
+    // the mode the generated code relies on.
+    virtual std::string generateRuntimeSetup() = 0;
     virtual std::string generateCast(const std::string& expr, const Type& fromType, const Type& toType) = 0;
 };
 
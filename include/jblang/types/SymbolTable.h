@@ -6,6 +6,7 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include <set>
 #include "jblang/types/TypeSystem.h"
 #include "jblang/core/CompilerError.h"
 
@@ -92,6 +93,46 @@ public:
     }
     bool isGlobalScope() const { return scopes.size()==1; }
 
+    // Every variable declared in the enclosing function, innermost first. A
+    // shadowed one is left out, as its name no longer reaches it.
+    std::vector<Variable> getLocalSymbols() const
+    {
+        std::vector<Variable> locals;
+        std::set<std::string> seen;
+        for (auto it = scopes.rbegin(); it!=scopes.rend()-1; ++it) {
+            for (const auto& symbol : it->symbols) {
+                if (seen.insert(symbol.first).second) {
+                    locals.push_back(symbol.second);
+                }
+            }
+        }
+        return locals;
+    }
+
+    // Marks the variable a name reaches as having dropped its reference
+    // before the end of its scope, or, going down another path, as holding
+    // it again.
+    void setReleased(const std::string& name, bool released)
+    {
+        for (auto it = scopes.rbegin(); it!=scopes.rend(); ++it) {
+            if (it->symbols.count(name)) {
+                if (released) it->released.insert(name);
+                else it->released.erase(name);
+                return;
+            }
+        }
+    }
+
+    bool isReleased(const std::string& name) const
+    {
+        for (auto it = scopes.rbegin(); it!=scopes.rend(); ++it) {
+            if (it->symbols.count(name)) {
+                return it->released.count(name)>0;
+            }
+        }
+        return false;
+    }
+
     std::vector<std::pair<std::string, Type>> globalVars;
 
     std::shared_ptr<Function> currentFunc;
@@ -99,6 +140,7 @@ public:
 private:
     struct Scope {
       std::map<std::string, Variable> symbols;
+      std::set<std::string> released;
     };
 
     std::vector<Scope> scopes;
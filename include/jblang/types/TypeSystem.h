@@ -108,6 +108,10 @@ public:
     Type returnType;
     bool isStatic;
     bool isVirtual;
+    // Per parameter, whether the function only reads it: it never stores,
+    // returns or reassigns it, so the caller's own reference keeps it alive
+    // for the call and none needs counting for it.
+    std::vector<bool> borrowedParams;
 };
 
 class TypeSystem {
@@ -132,6 +136,12 @@ public:
     Type setClassParent(const std::string& className, const std::string& parentName);
     bool isSubclassOf(const std::string& child, const std::string& parent) const;
     std::vector<std::pair<std::string, Type>> getAllClassMembers(const std::string& className) const;
+    // Member paths, such as "parent.next" or "children[2]", of every pointer
+    // held in an object of the named struct or class.
+    std::vector<std::string> getPointerFields(const std::string& name) const;
+    // The pointer fields that own a reference count: strings are left out, as
+    // they point at literals rather than heap objects.
+    std::vector<std::string> getCountedFields(const std::string& name) const;
     void registerClassMethod(const std::string& className, std::shared_ptr<Function> method);
     void registerClassConstructor(const std::string& className, std::shared_ptr<Function> constructor);
     std::shared_ptr<Function> getClassConstructor(const std::string& className) const;
@@ -144,6 +154,7 @@ public:
     std::string findMethodImplementation(const std::string& className, const std::string& methodName) const;
     void registerTypeDef(const std::string& name, Type type);
     void registerFunction(std::shared_ptr<Function> func);
+    std::shared_ptr<Function> getFunction(const std::string& name) const;
 
     const std::string& getDefineValue(const std::string& key) const
     {
@@ -185,6 +196,9 @@ private:
     std::map<std::string, std::shared_ptr<Function>> m_classConstructors;
 
     Type translateType(const std::string& sourceType);
+    std::vector<std::string> collectPointerFields(const std::string& name, bool includeStrings) const;
+    void collectPointerFields(const std::string& path, const Type& type, bool includeStrings,
+            std::vector<std::string>& fields) const;
 };
 
 #endif //TYPESYSTEM_H
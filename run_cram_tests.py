@@ -29,6 +29,8 @@ def write_file(path, lines):
 def run_test(test_file, default_allocator):
     print(f"\n=== Running test: {test_file} ===")
     allocator = "reference_count" if "ref_count" in test_file else default_allocator
+    if "ref_count_deferred" in test_file:
+        allocator = "reference_count_deferred"
 
     test_name = os.path.splitext(os.path.basename(test_file))[0]
     expected_c_path = os.path.join(EXPECTED_C_DIR, f"{test_name}.c")
@@ -0,0 +1,64 @@
+#define _POSIX_C_SOURCE 199309L
+#include "mark_sweep_allocator.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+// Times a full mark-sweep collection over a live binary tree of increasing
+// size. With an O(1) pointer lookup the time per object should stay flat.
+
+typedef struct BenchNode {
+  struct BenchNode* left;
+  struct BenchNode* right;
+  long value;
+} BenchNode;
+
+static BenchNode* tree_root = NULL;
+
+static double elapsed_ms(struct timespec start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec-start.tv_sec)*1e3+(now.tv_nsec-start.tv_nsec)/1e6;
+}
+
+static BenchNode* build_tree(const RuntimeAllocator* gc, size_t count)
+{
+    BenchNode** nodes = malloc(count*sizeof(BenchNode*));
+    for (size_t i = 0; i<count; i++) {
+        nodes[i] = gc->alloc(sizeof(BenchNode));
+        nodes[i]->left = nodes[i]->right = NULL;
+        nodes[i]->value = (long) i;
+    }
+    for (size_t i = 0; i<count; i++) {
+        if (2*i+1<count) nodes[i]->left = nodes[2*i+1];
+        if (2*i+2<count) nodes[i]->right = nodes[2*i+2];
+    }
+    BenchNode* root = nodes[0];
+    free(nodes);
+    return root;
+}
+
+int main(void)
+{
+    const RuntimeAllocator* gc = get_mark_sweep_allocator();
+    gc->register_root(&tree_root);
+
+    printf("%10s %12s %14s\n", "objects", "gc ms", "ns/object");
+    for (size_t count = 25000; count<=800000; count *= 2) {
+        gc->init();
+        gc->set_gc_threshold(SIZE_MAX);
+        tree_root = build_tree(gc, count);
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        gc->gc();
+        double ms = elapsed_ms(start);
+
+        printf("%10zu %12.2f %14.1f\n", count, ms, ms*1e6/count);
+
+        tree_root = NULL;
+        gc->shutdown();
+    }
+    return 0;
+}
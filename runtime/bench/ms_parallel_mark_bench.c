@@ -0,0 +1,86 @@
+#define _POSIX_C_SOURCE 199309L
+#include "mark_sweep_allocator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+// Full collections over a large random object graph with an increasing number
+// of marker threads. Nearly the whole graph is live, so the pause is
+// dominated by marking.
+
+#define NODES 2000000
+#define EDGES 4
+#define DIRECTORY_SIZE 4096
+#define REPEATS 3
+
+typedef struct BenchNode {
+  struct BenchNode* edges[EDGES];
+  long value;
+} BenchNode;
+
+typedef struct Directory {
+  BenchNode* nodes[DIRECTORY_SIZE];
+} Directory;
+
+static Directory* directory = NULL;
+
+static uint64_t next_random(uint64_t* state)
+{
+    *state ^= *state<<13;
+    *state ^= *state>>7;
+    *state ^= *state<<17;
+    return *state;
+}
+
+static void build_graph(const RuntimeAllocator* gc)
+{
+    BenchNode** nodes = malloc(NODES*sizeof(BenchNode*));
+    if (!nodes) exit(1);
+    for (long i = 0; i<NODES; i++) {
+        nodes[i] = gc->alloc(sizeof(BenchNode));
+        nodes[i]->value = i;
+    }
+
+    uint64_t state = 88172645463325252ULL;
+    for (long i = 0; i<NODES; i++) {
+        for (int e = 0; e<EDGES; e++) {
+            nodes[i]->edges[e] = nodes[next_random(&state)%NODES];
+        }
+    }
+    directory = gc->alloc(sizeof(Directory));
+    for (long i = 0; i<DIRECTORY_SIZE; i++) {
+        directory->nodes[i] = nodes[next_random(&state)%NODES];
+    }
+    free(nodes);
+}
+
+int main(void)
+{
+    const RuntimeAllocator* gc = get_mark_sweep_allocator();
+    gc->register_root(&directory);
+    gc->init();
+    gc->set_gc_threshold(SIZE_MAX);
+    build_graph(gc);
+
+    AllocatorStats* stats = gc->get_stats();
+    printf("%d nodes, %zu bytes\n", NODES, stats->current_bytes);
+    printf("%8s %14s %10s\n", "threads", "best pause ms", "speedup");
+
+    double serial_ms = 0;
+    for (unsigned threads = 1; threads<=8; threads *= 2) {
+        gc->set_gc_threads(threads);
+        double best_ms = 0;
+        for (int r = 0; r<REPEATS; r++) {
+            gc->gc();
+            double ms = stats->last_pause_ns/1e6;
+            if (r==0 || ms<best_ms) best_ms = ms;
+        }
+        if (threads==1) serial_ms = best_ms;
+        printf("%8u %14.3f %9.2fx\n", threads, best_ms, serial_ms/best_ms);
+    }
+
+    directory = NULL;
+    gc->shutdown();
+    return 0;
+}
@@ -0,0 +1,101 @@
+#define _POSIX_C_SOURCE 200112L
+#include "runtime.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+
+// Counts references up and down over a list of nodes: through the inlined
+// runtime_inc_ref_count and runtime_dec_ref_count, through the out-of-line
+// functions the macros stand in for, and as a plain integer in each node,
+// which is as cheap as an update could be. Built with USE_REF_COUNT.
+
+#define LIST_LENGTH 1000
+#define ROUNDS 100000
+
+typedef struct Node {
+  struct Node* next;
+  long plain_count;
+} Node;
+
+static void release_node(void* object)
+{
+    runtime_dec_ref_count(((Node*) object)->next, 0);
+}
+
+static const size_t node_pointers[] = {offsetof(Node, next)};
+static TypeDescriptor node_type = {1, node_pointers, 0, release_node};
+
+static double now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec*1e3+now.tv_nsec/1e6;
+}
+
+static double inlined(Node* list)
+{
+    double start = now_ms();
+    for (int round = 0; round<ROUNDS; round++) {
+        for (Node* node = list; node; node = node->next) {
+            runtime_inc_ref_count(node, NULL);
+        }
+        for (Node* node = list; node; node = node->next) {
+            runtime_dec_ref_count(node, 0);
+        }
+    }
+    return now_ms()-start;
+}
+
+static double out_of_line(Node* list)
+{
+    double start = now_ms();
+    for (int round = 0; round<ROUNDS; round++) {
+        for (Node* node = list; node; node = node->next) {
+            (runtime_inc_ref_count)(node, NULL);
+        }
+        for (Node* node = list; node; node = node->next) {
+            (runtime_dec_ref_count)(node, 0);
+        }
+    }
+    return now_ms()-start;
+}
+
+static double plain(Node* list)
+{
+    double start = now_ms();
+    for (int round = 0; round<ROUNDS; round++) {
+        for (Node* node = list; node; node = node->next) {
+            node->plain_count++;
+        }
+        __asm__ volatile("" : : : "memory");
+        for (Node* node = list; node; node = node->next) {
+            node->plain_count--;
+        }
+        __asm__ volatile("" : : : "memory");
+    }
+    return now_ms()-start;
+}
+
+int main(void)
+{
+    runtime_init();
+    Node* head = NULL;
+    for (long i = 0; i<LIST_LENGTH; i++) {
+        Node* node = runtime_alloc_typed(sizeof(Node), &node_type);
+        node->next = head;
+        head = node;
+    }
+
+    double operations = 2.0*ROUNDS*LIST_LENGTH;
+    printf("%12s %10s %12s\n", "updates", "ms", "ns/update");
+    const char* labels[] = {"inlined", "out of line", "plain"};
+    double (* runs[])(Node*) = {inlined, out_of_line, plain};
+    for (int i = 0; i<3; i++) {
+        double elapsed = runs[i](head);
+        printf("%12s %10.1f %12.2f\n", labels[i], elapsed, elapsed*1e6/operations);
+    }
+
+    runtime_dec_ref_count(head, 0);
+    runtime_shutdown();
+    return 0;
+}
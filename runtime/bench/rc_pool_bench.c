@@ -0,0 +1,85 @@
+#define _POSIX_C_SOURCE 200112L
+#include "reference_count_allocator.h"
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+
+// Builds a long list of small nodes and drops it, then allocates and frees
+// one node at a time. Reports what each node costs in counted bytes and in
+// resident memory, and how fast nodes are allocated and freed. Built once
+// with full headers and once with RC_COMPACT_HEADER.
+
+#define LIST_LENGTH 1000000
+#define CHURN 20000000
+
+typedef struct Node {
+  struct Node* next;
+  long value;
+} Node;
+
+static const RuntimeAllocator* rc;
+
+static void release_node(void* object)
+{
+    rc->dec_ref_count(((Node*) object)->next, 0);
+}
+
+static TypeDescriptor node_type = {0, NULL, 0, release_node};
+
+static double now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec*1e3+now.tv_nsec/1e6;
+}
+
+static long peak_rss_kb(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+int main(void)
+{
+    rc = get_reference_count_allocator();
+    rc->init();
+    AllocatorStats* stats = rc->get_stats();
+
+    long rss_before = peak_rss_kb();
+    double start = now_ms();
+    Node* head = NULL;
+    for (long i = 0; i<LIST_LENGTH; i++) {
+        Node* node = rc->alloc_typed(sizeof(Node), &node_type);
+        node->next = head;
+        node->value = i;
+        head = node;
+    }
+    double alloc_ms = now_ms()-start;
+    double counted = (double) stats->current_bytes/LIST_LENGTH;
+    double resident = (peak_rss_kb()-rss_before)*1024.0/LIST_LENGTH;
+
+    start = now_ms();
+    rc->dec_ref_count(head, 0);
+    double free_ms = now_ms()-start;
+
+    start = now_ms();
+    for (long i = 0; i<CHURN; i++) {
+        Node* node = rc->alloc_typed(sizeof(Node), &node_type);
+        node->value = i;
+        rc->dec_ref_count(node, 0);
+    }
+    double churn_ms = now_ms()-start;
+
+#ifdef RC_COMPACT_HEADER
+    const char* header = "compact";
+#else
+    const char* header = "full";
+#endif
+    printf("%8s %14s %14s %12s %12s %12s\n", "header", "bytes/object", "rss/object", "alloc Mops", "free Mops",
+            "churn Mops");
+    printf("%8s %14.1f %14.1f %12.1f %12.1f %12.1f\n", header, counted, resident, LIST_LENGTH/alloc_ms/1e3,
+            LIST_LENGTH/free_ms/1e3, CHURN/churn_ms/1e3);
+    rc->shutdown();
+    return 0;
+}
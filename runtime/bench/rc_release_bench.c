@@ -0,0 +1,106 @@
+#define _POSIX_C_SOURCE 200112L
+#include "reference_count_allocator.h"
+#include <stdio.h>
+#include <time.h>
+
+// Drops the only reference to a long list and to a wide tree, then keeps
+// allocating until every object in them is freed. The worst pause is the
+// longest single operation, the drop itself included: with no budget that is
+// the whole cascade, with one it is the drop or allocation that frees the
+// most.
+
+#define LIST_LENGTH 1000000
+#define FANOUT 8
+#define TREE_DEPTH 7
+
+typedef struct Node {
+  struct Node* children[FANOUT];
+  long value;
+} Node;
+
+static const RuntimeAllocator* rc;
+
+static void release_node(void* object)
+{
+    Node* self = object;
+    for (int i = 0; i<FANOUT; i++) {
+        rc->dec_ref_count(self->children[i], 0);
+    }
+}
+
+static TypeDescriptor node_type = {0, NULL, 0, release_node};
+
+static Node* build_list(void)
+{
+    Node* head = NULL;
+    for (long i = 0; i<LIST_LENGTH; i++) {
+        Node* node = rc->alloc_typed(sizeof(Node), &node_type);
+        node->children[0] = head;
+        head = node;
+    }
+    return head;
+}
+
+static Node* build_tree(int depth)
+{
+    Node* node = rc->alloc_typed(sizeof(Node), &node_type);
+    if (depth>0) {
+        for (int i = 0; i<FANOUT; i++) {
+            node->children[i] = build_tree(depth-1);
+        }
+    }
+    return node;
+}
+
+static double now_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec*1e6+now.tv_nsec/1e3;
+}
+
+static void run(const char* graph, Node* (* build)(void), size_t budget)
+{
+    rc->init();
+    rc->set_free_budget(budget);
+    AllocatorStats* stats = rc->get_stats();
+    Node* root = build();
+    size_t objects = stats->total_allocations;
+
+    double start = now_us();
+    rc->dec_ref_count(root, 0);
+    double worst = now_us()-start;
+    size_t operations = 1;
+    while (stats->total_objects_freed<objects) {
+        double before = now_us();
+        void* scratch = rc->alloc(sizeof(Node));
+        double pause = now_us()-before;
+        if (pause>worst) worst = pause;
+        rc->dec_ref_count(scratch, 0);
+        operations++;
+    }
+    double total = now_us()-start;
+
+    printf("%6s %8zu %10zu %14.1f %12.1f %12zu\n", graph, budget, objects, worst, total/1e3, operations);
+    rc->shutdown();
+}
+
+static Node* build_full_tree(void)
+{
+    return build_tree(TREE_DEPTH);
+}
+
+int main(void)
+{
+    rc = get_reference_count_allocator();
+    printf("%6s %8s %10s %14s %12s %12s\n", "graph", "budget", "objects", "worst pause us", "drain ms",
+            "operations");
+    const size_t budgets[] = {0, 1024, 64};
+    for (int i = 0; i<3; i++) {
+        run("list", build_list, budgets[i]);
+    }
+    for (int i = 0; i<3; i++) {
+        run("tree", build_full_tree, budgets[i]);
+    }
+    return 0;
+}
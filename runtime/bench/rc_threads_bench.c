@@ -0,0 +1,132 @@
+#define _POSIX_C_SOURCE 200112L
+#include "reference_count_allocator.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+// Counts references up and down over lists of nodes, from one thread and
+// from several. Each thread walks either a list it allocated, which biased
+// counting keeps free of atomics, or one list they all share, which goes
+// through the atomic count. The atomic rows do the same walks on a plain
+// counter updated with atomic instructions, as an always-atomic count would;
+// they allocate in the thread-safe mode so that several threads can.
+
+#define THREADS 4
+#define LIST_LENGTH 1000
+#define ROUNDS 20000
+
+typedef struct Node {
+  struct Node* next;
+  long atomic_count;
+} Node;
+
+static const RuntimeAllocator* rc;
+static Node* shared_list = NULL;
+static bool atomic_counts = false;
+
+static Node* build(void)
+{
+    Node* head = NULL;
+    for (long i = 0; i<LIST_LENGTH; i++) {
+        Node* node = rc->alloc(sizeof(Node));
+        node->next = head;
+        head = node;
+    }
+    return head;
+}
+
+static void walk(Node* list)
+{
+    for (int round = 0; round<ROUNDS; round++) {
+        if (atomic_counts) {
+            for (Node* node = list; node; node = node->next) {
+                __atomic_add_fetch(&node->atomic_count, 1, __ATOMIC_RELAXED);
+            }
+            for (Node* node = list; node; node = node->next) {
+                __atomic_sub_fetch(&node->atomic_count, 1, __ATOMIC_ACQ_REL);
+            }
+            continue;
+        }
+        for (Node* node = list; node; node = node->next) {
+            rc->inc_ref_count(node, NULL);
+        }
+        for (Node* node = list; node; node = node->next) {
+            rc->dec_ref_count(node, 0);
+        }
+    }
+}
+
+static void drop(Node* list)
+{
+    while (list) {
+        Node* next = list->next;
+        rc->dec_ref_count(list, 0);
+        list = next;
+    }
+}
+
+static void* walk_own(void* arg)
+{
+    (void) arg;
+    Node* list = build();
+    walk(list);
+    drop(list);
+    return NULL;
+}
+
+static void* walk_shared(void* arg)
+{
+    (void) arg;
+    walk(shared_list);
+    return NULL;
+}
+
+static double now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec*1e3+now.tv_nsec/1e6;
+}
+
+static void run(const char* label, unsigned mode, bool atomic, int threads, void* (* body)(void*))
+{
+    rc->init();
+    rc->set_gc_mode(mode);
+    atomic_counts = atomic;
+    shared_list = build();
+
+    double start = now_ms();
+    if (threads==1) {
+        body(NULL);
+    }
+    else {
+        pthread_t workers[THREADS];
+        for (int i = 0; i<threads; i++) {
+            pthread_create(&workers[i], NULL, body, NULL);
+        }
+        for (int i = 0; i<threads; i++) {
+            pthread_join(workers[i], NULL);
+        }
+    }
+    double elapsed = now_ms()-start;
+    drop(shared_list);
+
+    double operations = 2.0*threads*ROUNDS*LIST_LENGTH;
+    size_t shared = rc->get_stats()->shared_updates;
+    printf("%-22s %8d %10.1f %14.2f %14zu\n", label, threads, elapsed, operations/elapsed/1e3, shared);
+    rc->shutdown();
+}
+
+int main(void)
+{
+    rc = get_reference_count_allocator();
+    printf("%-22s %8s %10s %14s %14s\n", "counts", "threads", "ms", "Mops/s", "shared ops");
+    run("plain", GC_MODE_DEFAULT, false, 1, walk_own);
+    run("biased", GC_MODE_THREAD_SAFE, false, 1, walk_own);
+    run("atomic", GC_MODE_THREAD_SAFE, true, 1, walk_own);
+    run("biased, own lists", GC_MODE_THREAD_SAFE, false, THREADS, walk_own);
+    run("atomic, own lists", GC_MODE_THREAD_SAFE, true, THREADS, walk_own);
+    run("biased, shared list", GC_MODE_THREAD_SAFE, false, THREADS, walk_shared);
+    run("atomic, shared list", GC_MODE_THREAD_SAFE, true, THREADS, walk_shared);
+    return 0;
+}
@@ -7,6 +7,7 @@
 typedef struct {
   const char* name;
   void* (* alloc)(size_t bytes);
+  void* (* alloc_typed)(size_t bytes, TypeDescriptor* type);
   void (* dealloc)(void* ptr);
   void (* gc)(void);
   void (* scope_end)(void);
@@ -16,7 +17,17 @@ typedef struct {
   void (* inc_ref_count)(void* ptr, void* other);
   void (* dec_ref_count)(void* ptr, size_t offset);
   void (* set_gc_threshold)(size_t threshold);
+  void (* set_gc_pacer)(unsigned growth_percent, size_t min_bytes, size_t max_bytes);
   void (* register_root)(void *ptr);
+  void (* register_roots)(const RootEntry* roots, size_t count);
+  void (* set_gc_mode)(unsigned modes);
+  void (* set_gc_step_budget)(size_t words);
+  void (* set_nursery_size)(size_t bytes);
+  void (* set_gc_threads)(unsigned threads);
+  void (* write_barrier)(void* field, void* value);
+  void (* set_free_budget)(size_t objects);
+  void (* set_cycle_buffer)(size_t objects);
+  void (* set_stack_bottom)(void* bottom);
 } RuntimeAllocator;
 
 const RuntimeAllocator* get_allocator_implementation(void);
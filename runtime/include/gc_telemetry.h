@@ -0,0 +1,16 @@
+#ifndef GC_TELEMETRY_H
+#define GC_TELEMETRY_H
+
+#include <stdio.h>
+#include "runtime.h"
+
+// Adds a pause to the totals and the histogram. Every stop of the mutator
+// counts, including ones that don't finish a collection.
+void telemetry_record_pause(AllocatorStats* stats, size_t pause_ns);
+
+// Keeps record as the next collection and adds it to the totals.
+void telemetry_record_collection(AllocatorStats* stats, const GcRecord* record);
+
+void telemetry_print_json(const AllocatorStats* stats, const char* allocator, FILE* out);
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef PAGE_MAP_H
+#define PAGE_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE ((size_t) 1<<PAGE_SHIFT)
+#define PAGE_GRANULE 8
+#define PAGE_GRANULES (PAGE_SIZE/PAGE_GRANULE)
+#define PAGE_MIN_CELL 16
+#define PAGE_MAX_CELLS (PAGE_SIZE/PAGE_MIN_CELL)
+#define PAGE_CELL_WORDS (PAGE_MAX_CELLS/64)
+
+typedef enum {
+  PAGE_OBJECTS,
+  PAGE_CELLS,
+  PAGE_LARGE
+} PageKind;
+
+// Per-page record of which heap objects live there.
+//
+// PAGE_OBJECTS pages hold individually malloc'd objects. They are registered
+// by start address; objects larger than a page also leave a pointer to their
+// start in every page they run into, so an interior pointer anywhere inside
+// an object resolves without walking the heap.
+//
+// PAGE_CELLS pages belong to the size-class heap and are carved into equal
+// cells, with allocation and mark state kept in side bitmaps. Each cell also
+// records the type tag it was allocated with, 0 meaning untyped.
+//
+// PAGE_LARGE pages make up a mapping that holds a single large object. All of
+// them share one PageInfo, whose base is the start of the mapping.
+typedef struct PageInfo {
+  PageKind kind;
+  size_t objects;
+
+  uint64_t starts[PAGE_GRANULES/64];
+  void* spanning;
+
+  char* base;
+  unsigned size_class;
+  size_t cell_size;
+  size_t cell_count;
+  uint32_t cell_reciprocal;
+  uint64_t alloc_bits[PAGE_CELL_WORDS];
+  uint64_t mark_bits[PAGE_CELL_WORDS];
+  uint16_t cell_tags[PAGE_MAX_CELLS];
+  bool unswept;
+  bool pinned;
+  bool evacuating;
+  uint8_t dirty_cards;
+  struct PageInfo* next;
+  struct PageInfo* prev;
+  struct PageInfo* next_available;
+} PageInfo;
+
+void page_map_insert(void* start, size_t size);
+void page_map_remove(void* start, size_t size);
+// Registers the size bytes of pages from start as one PAGE_LARGE span.
+PageInfo* page_map_add_span(void* start, size_t size);
+void page_map_remove_span(void* start, size_t size);
+PageInfo* page_map_add_page(void* page);
+void page_map_remove_page(void* page);
+PageInfo* page_map_lookup(const void* addr);
+// Whether addr lies between the lowest and highest addresses ever registered.
+bool page_map_in_range(const void* addr);
+
+// Returns the start of the registered object on a PAGE_OBJECTS page that
+// could contain ptr, or NULL. The caller still has to check ptr against the
+// object's size.
+void* page_find_object(const PageInfo* page, const void* ptr);
+
+void page_map_clear(void);
+
+static inline size_t page_cell_index(const PageInfo* page, const void* ptr)
+{
+    uint64_t offset = (uint64_t) ((const char*) ptr-page->base);
+    return (size_t) ((offset*page->cell_reciprocal)>>32);
+}
+
+static inline void* page_cell(const PageInfo* page, size_t index)
+{
+    return page->base+index*page->cell_size;
+}
+
+static inline bool page_bit(const uint64_t* bits, size_t index)
+{
+    return (bits[index/64]>>(index%64)) & 1;
+}
+
+static inline void page_set_bit(uint64_t* bits, size_t index)
+{
+    bits[index/64] |= (uint64_t) 1<<(index%64);
+}
+
+static inline void page_clear_bit(uint64_t* bits, size_t index)
+{
+    bits[index/64] &= ~((uint64_t) 1<<(index%64));
+}
+
+#endif
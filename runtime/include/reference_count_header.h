@@ -0,0 +1,110 @@
+#ifndef REFERENCE_COUNT_HEADER_H
+#define REFERENCE_COUNT_HEADER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "runtime.h"
+
+// The references an object holds are found through its type: its pointer
+// offsets list them, and the release function the compiler emits drops each
+// of them. An untyped object holds none that are counted.
+#ifdef RC_COMPACT_HEADER
+// Compact headers fit in a word: a 32-bit count, the object's size class,
+// its type as a tag into type_table, its cycle collection color, and whether
+// it is in the zero count table or the cycle root buffer. Objects too big
+// for a class keep their size in a word in front of the header. There is no
+// room for the thread-safe counts, so GC_MODE_THREAD_SAFE is ignored, nor
+// for a position in the cycle root buffer, so a dead object still in the
+// buffer keeps its cell until the next collection.
+typedef struct RefcountHeader {
+  uint32_t count;
+  uint16_t tag;
+  unsigned char size_class;
+  unsigned char color : 6;
+  unsigned char zct : 1;
+  unsigned char buffered : 1;
+} RefcountHeader;
+#else
+// Under GC_MODE_THREAD_SAFE the count is biased towards the thread that
+// allocated the object: only its owner updates count, without atomics, and
+// every other thread goes through shared instead. shared holds a count of its
+// own, which may go below zero, above two flags. Once the owner lets go of
+// its count, both are merged into shared and owner becomes 0.
+typedef struct RefcountHeader {
+  long long count;
+  long long shared;
+  size_t size;
+  const TypeDescriptor* type;
+  unsigned owner;
+  // Position in the cycle root buffer plus one, or 0 when not buffered.
+  unsigned root_slot;
+  unsigned char color;
+  // Set while the object is in the zero count table under GC_MODE_DEFERRED.
+  unsigned char zct;
+} RefcountHeader;
+#endif
+
+// Cycle collection colors, after Bacon and Rajan. Black objects are in use,
+// purple ones may be the root of a garbage cycle, and gray and white ones are
+// being tested for it. Green ones hold no counted references, so they can't
+// be part of a cycle. With compact headers, a released object still in the
+// root buffer is freed when the buffer lets it go.
+enum {
+  RC_COLOR_BLACK,
+  RC_COLOR_GRAY,
+  RC_COLOR_WHITE,
+  RC_COLOR_PURPLE,
+  RC_COLOR_GREEN,
+  RC_COLOR_RELEASED
+};
+
+extern AllocatorStats rc_stats;
+#ifndef RC_COMPACT_HEADER
+extern bool rc_thread_safe;
+#endif
+
+// The slow paths of a decrement: releasing an object whose count reached
+// zero, or under GC_MODE_DEFERRED putting it in the zero count table, and
+// buffering a black one whose count dropped as a possible cycle
+// root.
+void rc_release(RefcountHeader* header);
+void rc_possible_root(RefcountHeader* header);
+
+// A program built against the reference-counting runtime, with the same
+// USE_REF_COUNT and RC_COMPACT_HEADER flags, updates counts inline and only
+// calls into the runtime when a count drops to zero or an object may have
+// become a cycle root. Thread-safe counts and DEBUG builds always call in.
+#if defined(USE_REF_COUNT) && !defined(DEBUG)
+static inline void runtime_inc_ref_count_inline(void* ptr, void* other)
+{
+#ifndef RC_COMPACT_HEADER
+    if (rc_thread_safe) {
+        runtime_inc_ref_count(ptr, other);
+        return;
+    }
+#endif
+    (void) other;
+    rc_stats.total_increments++;
+    if (ptr) ((RefcountHeader*) ptr-1)->count++;
+}
+
+static inline void runtime_dec_ref_count_inline(void* ptr, size_t offset)
+{
+#ifndef RC_COMPACT_HEADER
+    if (rc_thread_safe) {
+        runtime_dec_ref_count(ptr, offset);
+        return;
+    }
+#endif
+    rc_stats.total_decrements++;
+    if (!ptr) return;
+    RefcountHeader* header = (RefcountHeader*) ((char*) ptr-offset)-1;
+    if (--header->count==0) rc_release(header);
+    else if (header->color==RC_COLOR_BLACK) rc_possible_root(header);
+}
+
+#define runtime_inc_ref_count(ptr, other) runtime_inc_ref_count_inline(ptr, other)
+#define runtime_dec_ref_count(ptr, offset) runtime_dec_ref_count_inline(ptr, offset)
+#endif
+
+#endif
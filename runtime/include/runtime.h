@@ -5,25 +5,178 @@
 #include <stddef.h>
 
 void* runtime_alloc(size_t bytes);
+
+// Layout of a heap type, emitted by the compiler for each struct and class.
+// A collector that knows an object's descriptor traces only the listed
+// pointer fields instead of every word; a pointer_count of 0 marks an object
+// that holds no pointers at all. tag is assigned by the collector. When
+// reference counting, the offsets are those of the counted references an
+// object holds, and release drops them all just before it is freed.
+typedef struct TypeDescriptor {
+  size_t pointer_count;
+  const size_t* pointer_offsets;
+  unsigned tag;
+  void (* release)(void* object);
+} TypeDescriptor;
+
+// Descriptor for ints, bools and other buffers without pointers.
+extern TypeDescriptor runtime_pointer_free;
+
+// Like runtime_alloc, for an object laid out as type describes. Allocators
+// without precise tracing treat it as a plain allocation.
+void* runtime_alloc_typed(size_t bytes, TypeDescriptor* type);
 void runtime_scope_end(void);
 void runtime_init(void);
 void runtime_shutdown(void);
 void runtime_gc(void);
+// Fixes the heap size that triggers a collection, turning off pacing.
 void runtime_set_gc_threshold(size_t threshold);
+// Paces collections instead: after each one, the next is triggered once the
+// heap has grown by growth_percent over what survived, kept between
+// min_bytes and max_bytes. This is the default, at 100% from 1 MB up.
+void runtime_set_gc_pacer(unsigned growth_percent, size_t min_bytes, size_t max_bytes);
 void runtime_register_root(void* ptr);
 
+// A global holding heap pointers. With pointer_offsets, the pointers lie at
+// those offsets from address; without, address holds pointer_count pointers
+// in a row.
+typedef struct RootEntry {
+  void* address;
+  size_t pointer_count;
+  const size_t* pointer_offsets;
+} RootEntry;
+
+// Registers a whole table of globals at once. The table is used in place, so
+// it must outlive the runtime; the compiler emits it as a static array.
+void runtime_register_roots(const RootEntry* roots, size_t count);
+
+// Collector modes, combined as flags. Allocators ignore the ones they don't
+// support. GC_MODE_GENERATIONAL takes precedence over GC_MODE_INCREMENTAL and
+// GC_MODE_COMPACT. A compacting collection sweeps eagerly. GC_MODE_THREAD_SAFE
+// lets a reference-counting allocator's objects be shared between threads;
+// it must be set before the first allocation, and it turns off cycle
+// collection. GC_MODE_DEFERRED has a reference-counting allocator count only
+// the references held in the heap, finding the rest by scanning the stack and
+// the registered roots now and then; it too must be set before the first
+// allocation, turns off cycle collection, and gives way to
+// GC_MODE_THREAD_SAFE.
+typedef enum {
+  GC_MODE_DEFAULT = 0,
+  GC_MODE_LAZY_SWEEP = 1<<0,
+  GC_MODE_INCREMENTAL = 1<<1,
+  GC_MODE_GENERATIONAL = 1<<2,
+  GC_MODE_CONCURRENT_SWEEP = 1<<3,
+  GC_MODE_COMPACT = 1<<4,
+  GC_MODE_THREAD_SAFE = 1<<5,
+  GC_MODE_DEFERRED = 1<<6
+} GcMode;
+
+void runtime_set_gc_mode(unsigned modes);
+// Words of heap an incremental collector scans per allocation.
+void runtime_set_gc_step_budget(size_t words);
+// Bytes a generational collector allocates between minor collections.
+void runtime_set_nursery_size(size_t bytes);
+// Threads a collector marks with. runtime_init takes the initial count from
+// the JBLANG_GC_THREADS environment variable, defaulting to one.
+void runtime_set_gc_threads(unsigned threads);
+// Called before a pointer field of a heap object is overwritten. field is the
+// slot (NULL for a fresh initializer) and value the new pointer, if known.
+void runtime_write_barrier(void* field, void* value);
+
 void runtime_inc_ref_count(void* ptr, void* other);
 void runtime_dec_ref_count(void* ptr, size_t offset);
+// Objects a reference-counting allocator frees per operation once counts
+// start dropping to zero; the rest wait for later allocations, scope ends and
+// runtime_gc. 0 frees everything that dies straight away. runtime_init takes
+// the initial budget from the JBLANG_GC_FREE_BUDGET environment variable.
+void runtime_set_free_budget(size_t objects);
+// Objects whose count dropped without reaching zero that a reference-counting
+// allocator buffers as possible roots of garbage cycles before it tests them
+// all, freeing the cycles it finds. runtime_gc tests them straight away.
+void runtime_set_cycle_buffer(size_t objects);
+// The highest stack address a stack scan covers, taken by the program from
+// the frame every other call is made under, such as main's. A
+// reference-counting allocator needs it before GC_MODE_DEFERRED reconciles.
+void runtime_set_stack_bottom(void* bottom);
+
+// Why a collection ran.
+typedef enum {
+  GC_TRIGGER_THRESHOLD,
+  GC_TRIGGER_EXPLICIT,
+  GC_TRIGGER_NURSERY,
+  GC_TRIGGER_SHUTDOWN
+} GcTrigger;
+
+// One collection. Times are in nanoseconds, and bytes_marked is everything
+// that survived it.
+typedef struct {
+  GcTrigger trigger;
+  size_t mark_ns;
+  size_t sweep_ns;
+  size_t pause_ns;
+  size_t bytes_marked;
+  size_t objects_freed;
+  size_t bytes_freed;
+} GcRecord;
+
+#define GC_RECORD_HISTORY 64
+// Pauses are bucketed by their top three bits, so a bucket spans at most a
+// quarter of its lower bound.
+#define GC_PAUSE_BUCKETS 160
 
 typedef struct {
   size_t total_allocations;
   size_t current_bytes;
   size_t peak_bytes;
   size_t total_collections;
+  size_t total_objects_freed;
+  size_t total_bytes_freed;
+  // Calls a counting allocator has taken to update reference counts.
+  size_t total_increments;
+  size_t total_decrements;
+  // Those a thread made on an object another thread allocated, which go
+  // through an atomic count under GC_MODE_THREAD_SAFE.
+  size_t shared_updates;
+  // Possible cycle roots it holds now, and objects its collections have
+  // freed as parts of garbage cycles.
+  size_t cycle_roots;
+  size_t cycle_objects_freed;
+  size_t total_mark_ns;
+  size_t total_sweep_ns;
+  size_t pause_count;
+  size_t last_pause_ns;
+  size_t max_pause_ns;
+  size_t total_pause_ns;
+  size_t pause_histogram[GC_PAUSE_BUCKETS];
+  size_t last_live_bytes;
+  size_t next_gc_bytes;
+  size_t compacted_bytes;
+  // From the last collection's stack scan: objects it was first to reach
+  // through a word pointing into their middle, which is likely a false
+  // pointer, and the pages whose words hit no object at all. Large objects
+  // are kept off those pages; blacklisted_mappings counts every mapping given
+  // up so far for overlapping one.
+  size_t false_retained_objects;
+  size_t false_retained_bytes;
+  size_t blacklisted_pages;
+  size_t blacklisted_mappings;
+  // The last GC_RECORD_HISTORY collections. Collection n is kept in
+  // records[n%GC_RECORD_HISTORY].
+  GcRecord records[GC_RECORD_HISTORY];
 } AllocatorStats;
 
 const char* runtime_get_allocator_name(void);
 AllocatorStats* runtime_get_stats(void);
+// Approximate pause at the given percentile, from 0 to 100, of every pause so
+// far: the top of the histogram bucket it falls in, capped at the longest.
+size_t runtime_pause_percentile(const AllocatorStats* stats, double percentile);
+// Prints the stats as text, or as JSON on stderr when JBLANG_GC_STATS is set
+// to "json". runtime_shutdown prints them whenever JBLANG_GC_STATS is set.
 void runtime_print_stats(void);
 
+// Inlined count updates for programs built with USE_REF_COUNT.
+#ifdef USE_REF_COUNT
+#include "reference_count_header.h"
+#endif
+
 #endif
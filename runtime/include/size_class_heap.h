@@ -0,0 +1,49 @@
+#ifndef SIZE_CLASS_HEAP_H
+#define SIZE_CLASS_HEAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "page_map.h"
+
+// Objects up to this size are placed in size-class cells; anything larger is
+// left to the caller.
+#define SC_MAX_SIZE 1024
+
+void sc_init(void);
+void sc_shutdown(void);
+
+// Returns a zeroed cell of at least size bytes, or NULL if size is above
+// SC_MAX_SIZE. The cell is tagged with tag and its real size is stored in
+// *cell_size.
+void* sc_alloc(size_t size, uint16_t tag, size_t* cell_size);
+void sc_free(PageInfo* page, size_t index);
+
+void sc_clear_marks(void);
+
+// Frees every allocated cell whose mark bit is clear and returns the number
+// of bytes released; *freed_objects receives the number of cells.
+size_t sc_sweep(size_t* freed_objects);
+
+// Lazy sweeping: every page is flagged as unswept and is swept on demand when
+// sc_alloc runs out of free cells in its class. sc_finish_sweep sweeps
+// whatever is still pending and must run before the next mark phase.
+// sc_sweep_step sweeps a single pending page and may be called from another
+// thread than the one allocating; it returns false once nothing is pending.
+void sc_begin_lazy_sweep(void);
+size_t sc_finish_sweep(size_t* freed_objects);
+bool sc_sweep_step(void);
+bool sc_sweep_pending(void);
+
+// Compaction, after an eager sweep. sc_begin_evacuation flags the pages worth
+// emptying, the unpinned ones at most half full in classes that have at
+// least two, and stops handing out their cells; it returns how many there
+// are. Once the caller has copied every object on them elsewhere,
+// sc_finish_evacuation releases them and clears all pins.
+size_t sc_begin_evacuation(void);
+void sc_for_each_evacuating(void (* fn)(PageInfo* page, size_t index));
+void sc_finish_evacuation(void);
+
+void sc_for_each_object(void (* fn)(void* object, size_t size));
+void sc_for_each_marked(void (* fn)(void* object, size_t size));
+
+#endif
@@ -0,0 +1,116 @@
+#include "gc_telemetry.h"
+#include <stdio.h>
+
+// Bucket of a pause: its highest set bit picks a power of two and the two
+// bits below split that into quarters. The first four buckets hold 0-3 ns.
+static size_t pause_bucket(size_t ns)
+{
+    if (ns<4) return ns;
+    size_t top = 63-(size_t) __builtin_clzll((unsigned long long) ns);
+    size_t bucket = 4*(top-1)+((ns>>(top-2)) & 3);
+    return bucket<GC_PAUSE_BUCKETS ? bucket : GC_PAUSE_BUCKETS-1;
+}
+
+static size_t bucket_limit(size_t bucket)
+{
+    if (bucket<4) return bucket;
+    size_t top = bucket/4+1;
+    return ((4+bucket%4+1) << (top-2))-1;
+}
+
+void telemetry_record_pause(AllocatorStats* stats, size_t pause_ns)
+{
+    stats->pause_count++;
+    stats->last_pause_ns = pause_ns;
+    stats->total_pause_ns += pause_ns;
+    if (pause_ns>stats->max_pause_ns) stats->max_pause_ns = pause_ns;
+    stats->pause_histogram[pause_bucket(pause_ns)]++;
+}
+
+void telemetry_record_collection(AllocatorStats* stats, const GcRecord* record)
+{
+    stats->records[stats->total_collections%GC_RECORD_HISTORY] = *record;
+    stats->total_collections++;
+    stats->total_objects_freed += record->objects_freed;
+    stats->total_bytes_freed += record->bytes_freed;
+    stats->total_mark_ns += record->mark_ns;
+    stats->total_sweep_ns += record->sweep_ns;
+}
+
+size_t runtime_pause_percentile(const AllocatorStats* stats, double percentile)
+{
+    if (stats->pause_count==0) return 0;
+
+    double rank = percentile/100.0*(double) stats->pause_count;
+    size_t target = rank<1.0 ? 1 : (size_t) rank;
+    if ((double) target<rank) target++;
+    size_t seen = 0;
+    for (size_t bucket = 0; bucket<GC_PAUSE_BUCKETS; bucket++) {
+        seen += stats->pause_histogram[bucket];
+        if (seen>=target) {
+            size_t limit = bucket_limit(bucket);
+            return limit<stats->max_pause_ns ? limit : stats->max_pause_ns;
+        }
+    }
+    return stats->max_pause_ns;
+}
+
+static const char* trigger_name(GcTrigger trigger)
+{
+    switch (trigger) {
+    case GC_TRIGGER_THRESHOLD:
+        return "threshold";
+    case GC_TRIGGER_EXPLICIT:
+        return "explicit";
+    case GC_TRIGGER_NURSERY:
+        return "nursery";
+    case GC_TRIGGER_SHUTDOWN:
+        return "shutdown";
+    }
+    return "unknown";
+}
+
+void telemetry_print_json(const AllocatorStats* stats, const char* allocator, FILE* out)
+{
+    fprintf(out, "{\"allocator\":\"%s\"", allocator);
+    fprintf(out, ",\"total_allocations\":%zu,\"current_bytes\":%zu,\"peak_bytes\":%zu",
+            stats->total_allocations, stats->current_bytes, stats->peak_bytes);
+    fprintf(out, ",\"total_collections\":%zu,\"total_objects_freed\":%zu,\"total_bytes_freed\":%zu",
+            stats->total_collections, stats->total_objects_freed, stats->total_bytes_freed);
+    fprintf(out, ",\"total_increments\":%zu,\"total_decrements\":%zu",
+            stats->total_increments, stats->total_decrements);
+    fprintf(out, ",\"shared_updates\":%zu", stats->shared_updates);
+    fprintf(out, ",\"cycle_roots\":%zu,\"cycle_objects_freed\":%zu", stats->cycle_roots, stats->cycle_objects_freed);
+    fprintf(out, ",\"total_mark_ns\":%zu,\"total_sweep_ns\":%zu", stats->total_mark_ns, stats->total_sweep_ns);
+    fprintf(out, ",\"last_live_bytes\":%zu,\"next_gc_bytes\":%zu,\"compacted_bytes\":%zu",
+            stats->last_live_bytes, stats->next_gc_bytes, stats->compacted_bytes);
+    fprintf(out, ",\"false_retained_objects\":%zu,\"false_retained_bytes\":%zu",
+            stats->false_retained_objects, stats->false_retained_bytes);
+    fprintf(out, ",\"blacklisted_pages\":%zu,\"blacklisted_mappings\":%zu",
+            stats->blacklisted_pages, stats->blacklisted_mappings);
+
+    fprintf(out, ",\"pauses\":{\"count\":%zu,\"total_ns\":%zu,\"p50_ns\":%zu,\"p99_ns\":%zu,\"max_ns\":%zu",
+            stats->pause_count, stats->total_pause_ns, runtime_pause_percentile(stats, 50),
+            runtime_pause_percentile(stats, 99), stats->max_pause_ns);
+    fprintf(out, ",\"histogram\":[");
+    bool first = true;
+    for (size_t bucket = 0; bucket<GC_PAUSE_BUCKETS; bucket++) {
+        if (!stats->pause_histogram[bucket]) continue;
+        fprintf(out, "%s{\"le_ns\":%zu,\"count\":%zu}", first ? "" : ",", bucket_limit(bucket),
+                stats->pause_histogram[bucket]);
+        first = false;
+    }
+    fprintf(out, "]}");
+
+    fprintf(out, ",\"collections\":[");
+    size_t kept = stats->total_collections<GC_RECORD_HISTORY ? stats->total_collections : GC_RECORD_HISTORY;
+    for (size_t n = stats->total_collections-kept; n<stats->total_collections; n++) {
+        const GcRecord* record = &stats->records[n%GC_RECORD_HISTORY];
+        fprintf(out, "%s{\"index\":%zu,\"trigger\":\"%s\",\"mark_ns\":%zu,\"sweep_ns\":%zu,\"pause_ns\":%zu",
+                n==stats->total_collections-kept ? "" : ",", n, trigger_name(record->trigger),
+                record->mark_ns, record->sweep_ns, record->pause_ns);
+        fprintf(out, ",\"bytes_marked\":%zu,\"objects_freed\":%zu,\"bytes_freed\":%zu}",
+                record->bytes_marked, record->objects_freed, record->bytes_freed);
+    }
+    fprintf(out, "]}\n");
+}
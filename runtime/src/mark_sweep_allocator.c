@@ -1,35 +1,144 @@
+#define _POSIX_C_SOURCE 200112L
+#define _DEFAULT_SOURCE
 #include "mark_sweep_allocator.h"
+#include "page_map.h"
+#include "size_class_heap.h"
+#include "gc_telemetry.h"
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdint.h>
 #include <assert.h>
 #include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <sys/mman.h>
 
 static void* stack_bottom = NULL;
-static const size_t MAX_ROOTS = 50;
-static void** roots[MAX_ROOTS]; // Just for globals, which can't be found via stack scan
-static int root_index = 0;
+
+// Globals, which can't be found via stack scan. Roots registered one at a
+// time are copied here; whole tables are kept by reference.
+typedef struct RootTable {
+  const RootEntry* entries;
+  size_t count;
+} RootTable;
+
+static RootEntry* roots = NULL;
+static size_t root_count = 0;
+static size_t root_capacity = 0;
+static RootTable* root_tables = NULL;
+static size_t root_table_count = 0;
+static size_t root_table_capacity = 0;
 
 static size_t GC_THRESHOLD = 1024*1024; // 1mb
+// Unless a threshold was set by hand, GC_THRESHOLD is moved after every full
+// collection to gc_growth percent above the live heap, within these bounds.
+static bool gc_pacing = true;
+static unsigned gc_growth = 100;
+static size_t gc_min_threshold = 1024*1024;
+static size_t gc_max_threshold = SIZE_MAX;
+static unsigned gc_mode = GC_MODE_DEFAULT;
+static size_t gc_step_budget = 4096;
+static size_t nursery_size = 256*1024;
+
+// Set while an incremental cycle is between its root scan and its final
+// remark. Objects allocated meanwhile start out marked, and the write barrier
+// shades both the overwritten and the stored pointer.
+static bool marking = false;
 
 typedef struct MSHeader {
   bool marked;
+  bool remembered;
   size_t size;
+  const TypeDescriptor* type;
   struct MSHeader* next;
   struct MSHeader* prev;
 } MSHeader;
 
 static MSHeader* allocation_list = NULL;
+
+// The large-object space. Objects of LARGE_OBJECT_SIZE bytes or more get a
+// mapping of their own, headed by the usual MSHeader and registered in the
+// page map as a single span. They are kept on their own list, never move,
+// and are unmapped as soon as a sweep finds them dead.
+#define LARGE_OBJECT_SIZE ((size_t) 32*1024)
+static MSHeader* large_objects = NULL;
 static AllocatorStats stats = {0};
 
-static void ms_register_root(void* ptr)
+// Live size-class objects, and how many of them the last mark reached. In
+// lazy mode the difference is what the deferred sweep will free.
+static size_t cell_objects = 0;
+static size_t cell_bytes = 0;
+static size_t marked_cells = 0;
+static size_t marked_cell_bytes = 0;
+
+// Descriptors of the types allocated so far, indexed by the tag kept with
+// each cell. Tag 0 is left for untyped objects, which are scanned
+// conservatively, as is anything allocated once the tags run out.
+static const TypeDescriptor** type_table = NULL;
+static size_t type_count = 0;
+static size_t type_capacity = 0;
+
+static uint16_t type_tag(TypeDescriptor* type)
+{
+    if (!type) return 0;
+    if (type->tag) return (uint16_t) type->tag;
+    if (type_count>UINT16_MAX) return 0;
+
+    if (type_count==type_capacity) {
+        size_t capacity = type_capacity ? type_capacity*2 : 64;
+        const TypeDescriptor** grown = realloc(type_table, capacity*sizeof(TypeDescriptor*));
+        if (!grown) return 0;
+        type_table = grown;
+        type_capacity = capacity;
+    }
+    if (type_count==0) type_table[type_count++] = NULL;
+    type_table[type_count] = type;
+    type->tag = (unsigned) type_count;
+    return (uint16_t) type_count++;
+}
+
+static const TypeDescriptor* cell_type(const PageInfo* page, size_t index)
+{
+    return type_table ? type_table[page->cell_tags[index]] : NULL;
+}
+
+static void clear_type_table(void)
 {
-    if (root_index>=MAX_ROOTS) {
-        printf("Maximum registered roots exceeded.");
+    for (size_t i = 1; i<type_count; i++) {
+        ((TypeDescriptor*) type_table[i])->tag = 0;
+    }
+    free(type_table);
+    type_table = NULL;
+    type_count = type_capacity = 0;
+}
+
+static void* grow_array(void* array, size_t* capacity, size_t element_size)
+{
+    size_t grown_capacity = *capacity ? *capacity*2 : 64;
+    void* grown = realloc(array, grown_capacity*element_size);
+    if (!grown) {
+        printf("Failed to grow a collector table.");
         exit(1);
     }
-    roots[root_index++] = (void**) ptr;
+    *capacity = grown_capacity;
+    return grown;
+}
+
+static void ms_register_root(void* ptr)
+{
+    if (root_count==root_capacity) roots = grow_array(roots, &root_capacity, sizeof(RootEntry));
+    roots[root_count++] = (RootEntry) {ptr, 1, NULL};
+}
+
+static void ms_register_roots(const RootEntry* entries, size_t count)
+{
+    if (root_table_count==root_table_capacity) {
+        root_tables = grow_array(root_tables, &root_table_capacity, sizeof(RootTable));
+    }
+    root_tables[root_table_count++] = (RootTable) {entries, count};
 }
 
 static void add_allocation(MSHeader* header)
@@ -38,64 +147,533 @@ static void add_allocation(MSHeader* header)
     header->prev = NULL;
     if (allocation_list) allocation_list->prev = header;
     allocation_list = header;
+    page_map_insert(header, header->size);
 }
 
-static void remove_allocation(MSHeader* header)
+static void unlink_allocation(MSHeader* header)
 {
     if (header->prev) header->prev->next = header->next;
     else allocation_list = header->next;
     if (header->next) header->next->prev = header->prev;
 }
 
-static bool is_valid_pointer(void* ptr)
+static void remove_allocation(MSHeader* header)
 {
-    if (!ptr) return false;
+    unlink_allocation(header);
+    page_map_remove(header, header->size);
+}
 
-    MSHeader* current = allocation_list;
-    while (current) {
-        void* start = (void*) (current+1);
-        void* end = (char*) start+(current->size-sizeof(MSHeader));
-        if (ptr>=start && ptr<end) {
-            return true;
+// False-pointer blacklisting. Each root scan records the pages that stack
+// words point into without hitting an object, be it a stale pointer or an
+// integer that looks like one. A large object placed there would be kept
+// alive by that word for as long as it stays on the stack, so new mappings
+// that overlap a listed page are given up for another, a few times over.
+#define BLACKLIST_RETRIES 8
+
+static uintptr_t* blacklist = NULL;
+static size_t blacklist_count = 0;
+static size_t blacklist_capacity = 0;
+
+static void blacklist_page(const void* ptr)
+{
+    if (blacklist_count==blacklist_capacity) {
+        blacklist = grow_array(blacklist, &blacklist_capacity, sizeof(uintptr_t));
+    }
+    blacklist[blacklist_count++] = (uintptr_t) ptr>>PAGE_SHIFT;
+}
+
+static int compare_pages(const void* a, const void* b)
+{
+    uintptr_t x = *(const uintptr_t*) a;
+    uintptr_t y = *(const uintptr_t*) b;
+    return x<y ? -1 : x>y;
+}
+
+// Sorts the pages from the latest scan and drops duplicates.
+static void finish_blacklist(void)
+{
+    qsort(blacklist, blacklist_count, sizeof(uintptr_t), compare_pages);
+    size_t kept = 0;
+    for (size_t i = 0; i<blacklist_count; i++) {
+        if (kept==0 || blacklist[kept-1]!=blacklist[i]) blacklist[kept++] = blacklist[i];
+    }
+    blacklist_count = kept;
+    stats.blacklisted_pages = kept;
+}
+
+static bool blacklisted(const void* start, size_t size)
+{
+    uintptr_t first = (uintptr_t) start>>PAGE_SHIFT;
+    uintptr_t last = ((uintptr_t) start+size-1)>>PAGE_SHIFT;
+    size_t low = 0;
+    size_t high = blacklist_count;
+    while (low<high) {
+        size_t middle = low+(high-low)/2;
+        if (blacklist[middle]<first) low = middle+1;
+        else high = middle;
+    }
+    return low<blacklist_count && blacklist[low]<=last;
+}
+
+static size_t mapping_size(size_t size)
+{
+    return (size+PAGE_SIZE-1) & ~(PAGE_SIZE-1);
+}
+
+// The rejected mappings are only released at the end, so that the kernel
+// doesn't hand the same range back on the next try.
+static MSHeader* map_large_object(size_t size)
+{
+    size_t length = mapping_size(size);
+    void* rejected[BLACKLIST_RETRIES];
+    size_t rejects = 0;
+    void* start;
+    for (;;) {
+        start = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (start==MAP_FAILED || rejects==BLACKLIST_RETRIES || !blacklisted(start, length)) break;
+        rejected[rejects++] = start;
+        stats.blacklisted_mappings++;
+    }
+    for (size_t i = 0; i<rejects; i++) {
+        munmap(rejected[i], length);
+    }
+    if (start==MAP_FAILED) return NULL;
+    page_map_add_span(start, length);
+
+    MSHeader* header = start;
+    header->next = large_objects;
+    header->prev = NULL;
+    if (large_objects) large_objects->prev = header;
+    large_objects = header;
+    return header;
+}
+
+static void unmap_large_object(MSHeader* header)
+{
+    if (header->prev) header->prev->next = header->next;
+    else large_objects = header->next;
+    if (header->next) header->next->prev = header->prev;
+    page_map_remove_span(header, mapping_size(header->size));
+    munmap(header, mapping_size(header->size));
+}
+
+static MSHeader* find_header(const PageInfo* page, void* ptr)
+{
+    MSHeader* header = page->kind==PAGE_LARGE ? (MSHeader*) page->base : page_find_object(page, ptr);
+    if (!header) return NULL;
+
+    void* start = (void*) (header+1);
+    void* end = (char*) header+header->size;
+    return ptr>=start && ptr<end ? header : NULL;
+}
+
+// Marking is driven by an explicit stack of address ranges still to be
+// scanned, so the depth of the object graph never reaches the C stack. If the
+// stack cannot grow, further pushes are dropped and the overflow flag is set;
+// the objects are already marked, so a rescan of every marked object picks
+// up their unmarked children afterwards.
+#ifndef MARK_STACK_LIMIT
+#define MARK_STACK_LIMIT ((size_t) 1<<22)
+#endif
+#define MARK_STACK_INITIAL 1024
+
+// A range of words to trace. With a type, only its pointer fields are read,
+// at offsets from start.
+typedef struct MarkRange {
+  void** start;
+  void** end;
+  const TypeDescriptor* type;
+} MarkRange;
+
+static MarkRange* mark_stack = NULL;
+static size_t mark_stack_size = 0;
+static size_t mark_stack_capacity = 0;
+static bool mark_stack_overflowed = false;
+
+static void push_range(void** start, void** end, const TypeDescriptor* type)
+{
+    if (type && type->pointer_count==0) return;
+    if (mark_stack_size==mark_stack_capacity) {
+        size_t capacity = mark_stack_capacity ? mark_stack_capacity*2 : MARK_STACK_INITIAL;
+        if (capacity>MARK_STACK_LIMIT) capacity = MARK_STACK_LIMIT;
+        MarkRange* grown = capacity>mark_stack_capacity ? realloc(mark_stack, capacity*sizeof(MarkRange)) : NULL;
+        if (!grown) {
+            mark_stack_overflowed = true;
+            return;
         }
-        current = current->next;
+        mark_stack = grown;
+        mark_stack_capacity = capacity;
+    }
+    // Objects are scanned in roughly the order they are pushed, so start
+    // pulling this one into cache now.
+    __builtin_prefetch(start);
+    mark_stack[mark_stack_size++] = (MarkRange) {start, end, type};
+}
+
+static void mark(void* ptr)
+{
+    PageInfo* page = page_map_lookup(ptr);
+    if (!page) return;
+
+    if (page->kind==PAGE_CELLS) {
+        size_t index = page_cell_index(page, ptr);
+        if (index>=page->cell_count || !page_bit(page->alloc_bits, index)) return;
+        if (page_bit(page->mark_bits, index)) return;
+
+        page_set_bit(page->mark_bits, index);
+        marked_cells++;
+        marked_cell_bytes += page->cell_size;
+        void** start = (void**) page_cell(page, index);
+        push_range(start, (void**) ((char*) start+page->cell_size), cell_type(page, index));
+    }
+    else {
+        MSHeader* header = find_header(page, ptr);
+        if (!header || header->marked) return;
+
+        header->marked = true;
+        push_range((void**) (header+1), (void**) ((char*) header+header->size), header->type);
+    }
+}
+
+// Scans at most budget words. An untyped range bigger than what is left of
+// the budget is split and its tail pushed back for the next step; a typed one
+// costs its pointer count and is always scanned whole.
+static void scan_mark_stack(size_t budget)
+{
+    size_t work = 0;
+    while (mark_stack_size>0 && work<budget) {
+        MarkRange range = mark_stack[--mark_stack_size];
+        if (range.type) {
+            const char* object = (const char*) range.start;
+            for (size_t i = 0; i<range.type->pointer_count; i++) {
+                mark(*(void**) (object+range.type->pointer_offsets[i]));
+            }
+            work += range.type->pointer_count;
+            continue;
+        }
+        if ((size_t) (range.end-range.start)>budget-work) {
+            void** split = range.start+(budget-work);
+            mark_stack[mark_stack_size++] = (MarkRange) {split, range.end, NULL};
+            range.end = split;
+        }
+        else if (mark_stack_size>0) {
+            __builtin_prefetch(mark_stack[mark_stack_size-1].start);
+        }
+        work += range.end-range.start;
+        for (void** p = range.start; p<range.end; ++p) {
+            mark(*p);
+        }
+    }
+}
+
+static void drain_mark_stack(void)
+{
+    scan_mark_stack(SIZE_MAX);
+}
+
+static void rescan_marked_cell(void* object, size_t size)
+{
+    PageInfo* page = page_map_lookup(object);
+    push_range((void**) object, (void**) ((char*) object+size), cell_type(page, page_cell_index(page, object)));
+    drain_mark_stack();
+}
+
+static void rescan_marked_objects(MSHeader* list)
+{
+    for (MSHeader* header = list; header; header = header->next) {
+        if (!header->marked) continue;
+        push_range((void**) (header+1), (void**) ((char*) header+header->size), header->type);
+        drain_mark_stack();
+    }
+}
+
+static void recover_from_overflow(void)
+{
+    while (mark_stack_overflowed) {
+#ifdef DEBUG
+        printf("(debug) Mark stack overflowed, rescanning heap\n");
+#endif
+        mark_stack_overflowed = false;
+        sc_for_each_marked(rescan_marked_cell);
+        rescan_marked_objects(allocation_list);
+        rescan_marked_objects(large_objects);
+    }
+}
+
+// Parallel marking. The ranges found by the root scan are dealt out to one
+// marker per thread, the collecting thread being marker 0. Each marker works
+// through a private stack and, whenever its shared deque is empty, moves a
+// batch of its oldest ranges there for idle markers to steal. Mark bits are
+// set atomically, so two markers reaching the same object scan it only once.
+#define SHARE_BATCH 64
+#define SPLIT_WORDS 4096
+
+typedef struct Marker {
+  MarkRange* stack;
+  size_t size;
+  size_t capacity;
+  MarkRange* shared;
+  size_t shared_size;
+  pthread_mutex_t lock;
+  unsigned generation;
+  size_t marked_cells;
+  size_t marked_cell_bytes;
+} Marker;
+
+static unsigned gc_threads = 1;
+static Marker* markers = NULL;
+static pthread_t* mark_threads = NULL;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static unsigned pool_generation = 0;
+static unsigned pool_finished = 0;
+static bool pool_stopping = false;
+static unsigned active_markers = 0;
+static bool markers_overflowed = false;
+
+static void marker_push(Marker* m, void** start, void** end, const TypeDescriptor* type)
+{
+    if (type && type->pointer_count==0) return;
+    if (m->size==m->capacity) {
+        size_t capacity = m->capacity ? m->capacity*2 : MARK_STACK_INITIAL;
+        if (capacity>MARK_STACK_LIMIT) capacity = MARK_STACK_LIMIT;
+        MarkRange* grown = capacity>m->capacity ? realloc(m->stack, capacity*sizeof(MarkRange)) : NULL;
+        if (!grown) {
+            __atomic_store_n(&markers_overflowed, true, __ATOMIC_RELAXED);
+            return;
+        }
+        m->stack = grown;
+        m->capacity = capacity;
+    }
+    __builtin_prefetch(start);
+    m->stack[m->size++] = (MarkRange) {start, end, type};
+}
+
+static void marker_mark(Marker* m, void* ptr)
+{
+    PageInfo* page = page_map_lookup(ptr);
+    if (!page) return;
+
+    if (page->kind==PAGE_CELLS) {
+        size_t index = page_cell_index(page, ptr);
+        if (index>=page->cell_count || !page_bit(page->alloc_bits, index)) return;
+
+        uint64_t* word = &page->mark_bits[index/64];
+        uint64_t bit = (uint64_t) 1<<(index%64);
+        if ((__atomic_load_n(word, __ATOMIC_RELAXED) & bit)
+                || (__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit)) return;
+
+        m->marked_cells++;
+        m->marked_cell_bytes += page->cell_size;
+        void** start = (void**) page_cell(page, index);
+        marker_push(m, start, (void**) ((char*) start+page->cell_size), cell_type(page, index));
+    }
+    else {
+        MSHeader* header = find_header(page, ptr);
+        if (!header || __atomic_load_n(&header->marked, __ATOMIC_RELAXED)
+                || __atomic_exchange_n(&header->marked, true, __ATOMIC_RELAXED)) return;
+
+        marker_push(m, (void**) (header+1), (void**) ((char*) header+header->size), header->type);
+    }
+}
+
+// Moves the bottom of the private stack, the ranges pushed longest ago, to
+// the shared deque. It is only refilled once thieves have emptied it.
+static void marker_share(Marker* m)
+{
+    if (m->size<2*SHARE_BATCH || __atomic_load_n(&m->shared_size, __ATOMIC_RELAXED)>0) return;
+
+    pthread_mutex_lock(&m->lock);
+    if (m->shared_size==0) {
+        memcpy(m->shared, m->stack, SHARE_BATCH*sizeof(MarkRange));
+        memmove(m->stack, m->stack+SHARE_BATCH, (m->size-SHARE_BATCH)*sizeof(MarkRange));
+        m->size -= SHARE_BATCH;
+        __atomic_store_n(&m->shared_size, SHARE_BATCH, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&m->lock);
+}
+
+// Takes half of the first non-empty shared deque, starting with our own.
+static bool marker_steal(Marker* m)
+{
+    size_t self = (size_t) (m-markers);
+    for (unsigned i = 0; i<gc_threads; i++) {
+        Marker* victim = &markers[(self+i)%gc_threads];
+        if (__atomic_load_n(&victim->shared_size, __ATOMIC_RELAXED)==0) continue;
+
+        pthread_mutex_lock(&victim->lock);
+        size_t take = (victim->shared_size+1)/2;
+        for (size_t j = 0; j<take; j++) {
+            MarkRange range = victim->shared[--victim->shared_size];
+            marker_push(m, range.start, range.end, range.type);
+        }
+        pthread_mutex_unlock(&victim->lock);
+        if (take>0) return true;
     }
     return false;
 }
 
-static MSHeader* find_header(void* ptr)
+static bool shared_work_left(void)
 {
-    if (!ptr) return NULL;
+    for (unsigned i = 0; i<gc_threads; i++) {
+        if (__atomic_load_n(&markers[i].shared_size, __ATOMIC_RELAXED)>0) return true;
+    }
+    return false;
+}
 
-    MSHeader* current = allocation_list;
-    while (current) {
-        void* start = (void*) (current+1);
-        void* end = (char*) start+(current->size-sizeof(MSHeader));
-        if (ptr>=start && ptr<end) {
-            return current;
+static void marker_drain(Marker* m)
+{
+    while (m->size>0) {
+        MarkRange range = m->stack[--m->size];
+        if (range.type) {
+            const char* object = (const char*) range.start;
+            for (size_t i = 0; i<range.type->pointer_count; i++) {
+                marker_mark(m, *(void**) (object+range.type->pointer_offsets[i]));
+            }
+            marker_share(m);
+            continue;
         }
-        current = current->next;
+        // Long ranges are scanned a piece at a time so the rest can be stolen.
+        if (range.end-range.start>SPLIT_WORDS) {
+            marker_push(m, range.start+SPLIT_WORDS, range.end, NULL);
+            range.end = range.start+SPLIT_WORDS;
+        }
+        for (void** p = range.start; p<range.end; ++p) {
+            marker_mark(m, *p);
+        }
+        marker_share(m);
     }
+}
+
+// A marker only goes idle with an empty stack after failing to steal, so
+// once no marker is active no work can appear anywhere.
+static void run_marker(Marker* m)
+{
+    for (;;) {
+        marker_drain(m);
+        if (marker_steal(m)) continue;
+
+        __atomic_sub_fetch(&active_markers, 1, __ATOMIC_SEQ_CST);
+        for (;;) {
+            if (shared_work_left()) {
+                __atomic_add_fetch(&active_markers, 1, __ATOMIC_SEQ_CST);
+                if (marker_steal(m)) break;
+                __atomic_sub_fetch(&active_markers, 1, __ATOMIC_SEQ_CST);
+            }
+            if (__atomic_load_n(&active_markers, __ATOMIC_SEQ_CST)==0) return;
+            sched_yield();
+        }
+    }
+}
+
+static void* mark_worker(void* arg)
+{
+    Marker* m = arg;
+    pthread_mutex_lock(&pool_lock);
+    for (;;) {
+        while (pool_generation==m->generation && !pool_stopping) {
+            pthread_cond_wait(&pool_wake, &pool_lock);
+        }
+        if (pool_stopping) break;
+        m->generation = pool_generation;
+        pthread_mutex_unlock(&pool_lock);
+
+        run_marker(m);
+
+        pthread_mutex_lock(&pool_lock);
+        if (++pool_finished==gc_threads-1) pthread_cond_signal(&pool_done);
+    }
+    pthread_mutex_unlock(&pool_lock);
     return NULL;
 }
 
-static void mark(void* ptr)
+static void stop_markers(void)
 {
-    MSHeader* header = find_header(ptr);
-    if (!header || header->marked) return;
+    if (!markers) return;
 
-    header->marked = true;
+    pthread_mutex_lock(&pool_lock);
+    pool_stopping = true;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
+    for (unsigned i = 1; i<gc_threads; i++) {
+        pthread_join(mark_threads[i-1], NULL);
+    }
+    for (unsigned i = 0; i<gc_threads; i++) {
+        pthread_mutex_destroy(&markers[i].lock);
+        free(markers[i].stack);
+        free(markers[i].shared);
+    }
+    free(markers);
+    free(mark_threads);
+    markers = NULL;
+    mark_threads = NULL;
+    pool_stopping = false;
+}
 
-    void** start = (void**) (header+1);
-    void** end = (void**) ((char*) header+header->size);
-    for (void** p = start; p<end; ++p) {
-        if (is_valid_pointer(*p)) {
-            mark(*p);
+static void start_markers(unsigned threads)
+{
+    gc_threads = threads ? threads : 1;
+    if (gc_threads==1) return;
+
+    markers = calloc(gc_threads, sizeof(Marker));
+    mark_threads = calloc(gc_threads-1, sizeof(pthread_t));
+    if (!markers || !mark_threads) {
+        printf("Failed to allocate marker threads.");
+        exit(1);
+    }
+    for (unsigned i = 0; i<gc_threads; i++) {
+        markers[i].shared = malloc(SHARE_BATCH*sizeof(MarkRange));
+        if (!markers[i].shared) {
+            printf("Failed to allocate marker threads.");
+            exit(1);
+        }
+        pthread_mutex_init(&markers[i].lock, NULL);
+        markers[i].generation = pool_generation;
+    }
+    for (unsigned i = 1; i<gc_threads; i++) {
+        if (pthread_create(&mark_threads[i-1], NULL, mark_worker, &markers[i])!=0) {
+            printf("Failed to start marker thread.");
+            exit(1);
         }
     }
 }
 
-static void conservative_scan_stack(void)
+// Hands whatever is on the serial mark stack to the markers and returns once
+// they have all run out of work. Overflow is left for the serial rescan.
+static void parallel_drain(void)
+{
+    for (size_t i = 0; i<mark_stack_size; i++) {
+        Marker* m = &markers[i%gc_threads];
+        marker_push(m, mark_stack[i].start, mark_stack[i].end, mark_stack[i].type);
+    }
+    mark_stack_size = 0;
+    markers_overflowed = false;
+    active_markers = gc_threads;
+
+    pthread_mutex_lock(&pool_lock);
+    pool_finished = 0;
+    pool_generation++;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
+
+    run_marker(&markers[0]);
+
+    pthread_mutex_lock(&pool_lock);
+    while (pool_finished<gc_threads-1) {
+        pthread_cond_wait(&pool_done, &pool_lock);
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    for (unsigned i = 0; i<gc_threads; i++) {
+        marked_cells += markers[i].marked_cells;
+        marked_cell_bytes += markers[i].marked_cell_bytes;
+        markers[i].marked_cells = markers[i].marked_cell_bytes = 0;
+    }
+    if (markers_overflowed) mark_stack_overflowed = true;
+}
+
+static void __attribute__((noinline)) conservative_scan_stack(void (* visit)(void* ptr))
 {
     void** bottom = (void**) stack_bottom;
 
@@ -107,47 +685,357 @@ static void conservative_scan_stack(void)
 
     if (stack_top<bottom) {
         for (void** p = stack_top; p<bottom; ++p) {
-            if (is_valid_pointer(*p)) {
-                mark(*p);
-            }
+            visit(*p);
         }
     }
     else {
         for (void** p = bottom; p<stack_top; ++p) {
-            if (is_valid_pointer(*p)) {
-                mark(*p);
+            visit(*p);
+        }
+    }
+}
+
+// Zeroes the stack just below the caller, where the next frames are about to
+// go, so that stale pointers left there by earlier calls are not picked up as
+// roots by the conservative scan.
+static void __attribute__((noinline)) clear_stack_below(void)
+{
+    void* scratch[256];
+    memset(scratch, 0, sizeof(scratch));
+    // Keeps the otherwise dead stores from being optimised away.
+    __asm__ volatile("" : : "r"(scratch) : "memory");
+}
+
+// Generational mode keeps mark bits from one collection to the next: a marked
+// object has survived a collection and is old, an unmarked one was allocated
+// since and is still in the nursery. A minor collection only traces the
+// nursery, from the roots and from the old objects the write barrier recorded
+// as possibly pointing into it: cards of CARD_SIZE bytes on size-class pages,
+// and whole objects for the large ones.
+#define CARD_SHIFT 9
+#define CARD_SIZE ((size_t) 1<<CARD_SHIFT)
+#define PAGE_CARDS (PAGE_SIZE/CARD_SIZE)
+
+static size_t young_bytes = 0;
+static PageInfo** dirty_pages = NULL;
+static size_t dirty_page_count = 0;
+static size_t dirty_page_capacity = 0;
+static size_t remembered_objects = 0;
+
+static void remember_field(void* field)
+{
+    PageInfo* page = page_map_lookup(field);
+    if (!page) return;
+
+    if (page->kind==PAGE_CELLS) {
+        if (!page->dirty_cards) {
+            if (dirty_page_count==dirty_page_capacity) {
+                size_t capacity = dirty_page_capacity ? dirty_page_capacity*2 : 64;
+                PageInfo** grown = realloc(dirty_pages, capacity*sizeof(PageInfo*));
+                if (!grown) {
+                    printf("Failed to grow the card table.");
+                    exit(1);
+                }
+                dirty_pages = grown;
+                dirty_page_capacity = capacity;
             }
+            dirty_pages[dirty_page_count++] = page;
+        }
+        page->dirty_cards |= (uint8_t) (1<<(((uintptr_t) field & (PAGE_SIZE-1))>>CARD_SHIFT));
+    }
+    else {
+        MSHeader* header = find_header(page, field);
+        if (header && !header->remembered) {
+            header->remembered = true;
+            remembered_objects++;
         }
     }
 }
 
-static void mark_phase(void)
+// Only the old cells on a dirty card need scanning; unmarked ones are in the
+// nursery and are traced anyway if anything reaches them.
+static void scan_card(PageInfo* page, unsigned card)
+{
+    char* start = page->base+card*CARD_SIZE;
+    size_t first = page_cell_index(page, start);
+    size_t last = page_cell_index(page, start+CARD_SIZE-1);
+    if (last>=page->cell_count) last = page->cell_count-1;
+
+    for (size_t i = first; i<=last; i++) {
+        if (!page_bit(page->mark_bits, i)) continue;
+        void** cell = page_cell(page, i);
+        push_range(cell, (void**) ((char*) cell+page->cell_size), cell_type(page, i));
+    }
+}
+
+static void scan_remembered_objects(MSHeader* list)
+{
+    for (MSHeader* header = list; header; header = header->next) {
+        if (header->remembered && header->marked) {
+            push_range((void**) (header+1), (void**) ((char*) header+header->size), header->type);
+        }
+    }
+}
+
+static void scan_remembered(void)
+{
+    for (size_t i = 0; i<dirty_page_count; i++) {
+        PageInfo* page = dirty_pages[i];
+        for (unsigned card = 0; card<PAGE_CARDS; card++) {
+            if (page->dirty_cards & (1<<card)) scan_card(page, card);
+        }
+    }
+    if (remembered_objects==0) return;
+    scan_remembered_objects(allocation_list);
+    scan_remembered_objects(large_objects);
+}
+
+// Runs before every sweep: once a collection has finished marking, nothing it
+// leaves behind is young, and sweeping may release dirty pages.
+static void clear_remembered(void)
+{
+    for (size_t i = 0; i<dirty_page_count; i++) {
+        dirty_pages[i]->dirty_cards = 0;
+    }
+    dirty_page_count = 0;
+    if (remembered_objects==0) return;
+    for (MSHeader* header = allocation_list; header; header = header->next) {
+        header->remembered = false;
+    }
+    for (MSHeader* header = large_objects; header; header = header->next) {
+        header->remembered = false;
+    }
+    remembered_objects = 0;
+}
+
+static void mark_root(const RootEntry* root)
+{
+    char* base = root->address;
+    for (size_t i = 0; i<root->pointer_count; i++) {
+        void** slot = root->pointer_offsets ? (void**) (base+root->pointer_offsets[i]) : (void**) base+i;
+        mark(*slot);
+    }
+}
+
+// A stack word that lands inside an object rather than at its start is as
+// likely to be false as real. What such words are first to reach is counted
+// as falsely retained; words that reach no object at all are blacklisted.
+static void mark_stack_word(void* ptr)
+{
+    PageInfo* page = page_map_lookup(ptr);
+    void* start = NULL;
+    size_t size = 0;
+    bool marked = false;
+    if (page && page->kind==PAGE_CELLS) {
+        size_t index = page_cell_index(page, ptr);
+        if (index<page->cell_count && page_bit(page->alloc_bits, index)) {
+            start = page_cell(page, index);
+            size = page->cell_size;
+            marked = page_bit(page->mark_bits, index);
+        }
+    }
+    else if (page) {
+        MSHeader* header = find_header(page, ptr);
+        if (header) {
+            start = header+1;
+            size = header->size;
+            marked = header->marked;
+        }
+    }
+
+    if (!start) {
+        if (page_map_in_range(ptr)) blacklist_page(ptr);
+        return;
+    }
+    if (ptr!=start && !marked) {
+        stats.false_retained_objects++;
+        stats.false_retained_bytes += size;
+    }
+    mark(ptr);
+}
+
+static void mark_roots(void)
+{
+    // Earlier work in this collection (sweeping, for one) leaves heap
+    // addresses where the scan's frames are about to go.
+    clear_stack_below();
+    // Pointers held only in callee-saved registers, such as an object
+    // allocated just before this collection, are spilled where the scan
+    // below will see them.
+    jmp_buf registers;
+    setjmp(registers);
+    // Globals go first, so that nothing they hold is put down to the stack.
+    for (size_t i = 0; i<root_count; i++) {
+        mark_root(&roots[i]);
+    }
+    for (size_t t = 0; t<root_table_count; t++) {
+        for (size_t i = 0; i<root_tables[t].count; i++) {
+            mark_root(&root_tables[t].entries[i]);
+        }
+    }
+    blacklist_count = 0;
+    conservative_scan_stack(mark_stack_word);
+    finish_blacklist();
+}
+
+// Concurrent sweeping. The collection itself only unregisters dead large
+// objects and flags the cell pages as unswept, as in lazy mode; a background
+// thread then frees the objects and sweeps the pages one at a time. The
+// objects leave the page map before the program resumes, since a live object
+// can share a page with them and the program reads that page's entry
+// without locking.
+// The program meanwhile only allocates from pages that have been swept,
+// sweeping one itself if its class has nothing else.
+static pthread_t sweeper;
+static bool sweeper_started = false;
+static pthread_mutex_t sweeper_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sweeper_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t sweeper_idle = PTHREAD_COND_INITIALIZER;
+static bool sweep_requested = false;
+static bool sweeper_busy = false;
+static bool sweeper_stopping = false;
+static MSHeader* dead_objects = NULL;
+
+static void free_dead_objects(MSHeader* dead)
+{
+    while (dead) {
+        MSHeader* next = dead->next;
+        free(dead);
+        dead = next;
+    }
+}
+
+static void* sweeper_main(void* arg)
+{
+    (void) arg;
+    pthread_mutex_lock(&sweeper_lock);
+    for (;;) {
+        while (!sweep_requested && !sweeper_stopping) {
+            pthread_cond_wait(&sweeper_wake, &sweeper_lock);
+        }
+        if (sweeper_stopping) break;
+        sweep_requested = false;
+        sweeper_busy = true;
+        MSHeader* dead = dead_objects;
+        dead_objects = NULL;
+        pthread_mutex_unlock(&sweeper_lock);
+
+        free_dead_objects(dead);
+        while (sc_sweep_step()) {}
+
+        pthread_mutex_lock(&sweeper_lock);
+        sweeper_busy = false;
+        pthread_cond_broadcast(&sweeper_idle);
+    }
+    pthread_mutex_unlock(&sweeper_lock);
+    return NULL;
+}
+
+static void start_sweeper(MSHeader* dead)
+{
+    if (!sweeper_started) {
+        if (pthread_create(&sweeper, NULL, sweeper_main, NULL)!=0) {
+            printf("Failed to start sweeper thread.");
+            exit(1);
+        }
+        sweeper_started = true;
+    }
+    pthread_mutex_lock(&sweeper_lock);
+    dead_objects = dead;
+    sweep_requested = true;
+    pthread_cond_signal(&sweeper_wake);
+    pthread_mutex_unlock(&sweeper_lock);
+}
+
+static void stop_sweeper(void)
+{
+    if (!sweeper_started) return;
+
+    pthread_mutex_lock(&sweeper_lock);
+    sweeper_stopping = true;
+    pthread_cond_signal(&sweeper_wake);
+    pthread_mutex_unlock(&sweeper_lock);
+    pthread_join(sweeper, NULL);
+    sweeper_started = false;
+    sweeper_stopping = false;
+}
+
+// Mark bits of pages still waiting to be swept are about to be cleared or,
+// in a minor collection, taken to mean old, so this waits for a background
+// sweep rather than racing it.
+static void finish_pending_sweep(void)
+{
+    if (sweeper_started) {
+        pthread_mutex_lock(&sweeper_lock);
+        MSHeader* dead = dead_objects;
+        dead_objects = NULL;
+        sweep_requested = false;
+        pthread_mutex_unlock(&sweeper_lock);
+        free_dead_objects(dead);
+    }
+    if (sc_sweep_pending()) {
+        size_t pending = 0;
+        sc_finish_sweep(&pending);
+    }
+    if (sweeper_started) {
+        pthread_mutex_lock(&sweeper_lock);
+        while (sweeper_busy) {
+            pthread_cond_wait(&sweeper_idle, &sweeper_lock);
+        }
+        pthread_mutex_unlock(&sweeper_lock);
+    }
+}
+
+static void start_marking(void)
 {
 #ifdef DEBUG
     printf("(debug) Starting conservative mark phase\n");
 #endif
 
+    finish_pending_sweep();
+
     MSHeader* current = allocation_list;
     while (current) {
         current->marked = false;
         current = current->next;
     }
-
-    conservative_scan_stack();
-    for (int i = 0; i<root_index; i++) {
-        if (is_valid_pointer(*roots[i])) {
-            mark(*roots[i]);
-        }
+    for (current = large_objects; current; current = current->next) {
+        current->marked = false;
     }
+    sc_clear_marks();
+    marked_cells = marked_cell_bytes = 0;
+    mark_stack_size = 0;
+    mark_stack_overflowed = false;
+    stats.false_retained_objects = stats.false_retained_bytes = 0;
+
+    mark_roots();
+    marking = true;
+}
+
+// Roots are only rescanned after incremental marking: the stack and globals
+// are not covered by the write barrier.
+static void finish_marking(bool rescan_roots)
+{
+    if (rescan_roots) mark_roots();
+    drain_mark_stack();
+    recover_from_overflow();
+    marking = false;
 }
 
-static void sweep_phase(void)
+// Objects outside the size-class heap are swept straight away, except that
+// a concurrent sweep leaves freeing the malloc'd ones to its thread. With
+// lazy set, cell pages are only flagged here and swept one at a time from
+// sc_alloc, but the dead cells are known from the mark counts and are
+// accounted for immediately. A concurrent sweep is a lazy one that a
+// background thread also works through.
+static void sweep_phase(bool lazy, bool concurrent, GcRecord* record)
 {
 #ifdef DEBUG
     printf("(debug) Starting sweep phase\n");
 #endif
 
     MSHeader* current = allocation_list;
+    MSHeader* dead = NULL;
     size_t freed_count = 0;
     size_t freed_bytes = 0;
 
@@ -157,44 +1045,344 @@ static void sweep_phase(void)
             freed_count++;
             freed_bytes += current->size;
             stats.current_bytes -= current->size;
-            stats.total_collections++;
-            remove_allocation(current);
-            free(current);
+            if (concurrent) {
+                remove_allocation(current);
+                current->next = dead;
+                dead = current;
+            }
+            else {
+                remove_allocation(current);
+                free(current);
+            }
         }
         current = next;
     }
 
+    current = large_objects;
+    while (current) {
+        MSHeader* next = current->next;
+        if (!current->marked) {
+            freed_count++;
+            freed_bytes += current->size;
+            stats.current_bytes -= current->size;
+            unmap_large_object(current);
+        }
+        current = next;
+    }
+
+    size_t freed_cells = 0;
+    size_t freed_cell_bytes = 0;
+    if (lazy || concurrent) {
+        freed_cells = cell_objects-marked_cells;
+        freed_cell_bytes = cell_bytes-marked_cell_bytes;
+        sc_begin_lazy_sweep();
+    }
+    else {
+        freed_cell_bytes = sc_sweep(&freed_cells);
+    }
+    cell_objects -= freed_cells;
+    cell_bytes -= freed_cell_bytes;
+    freed_count += freed_cells;
+    freed_bytes += freed_cell_bytes;
+    stats.current_bytes -= freed_cell_bytes;
+    if (concurrent) start_sweeper(dead);
+    record->objects_freed = freed_count;
+    record->bytes_freed = freed_bytes;
+    record->bytes_marked = stats.current_bytes;
+
 #ifdef DEBUG
     printf("(debug) Freed %zu objects (%zu bytes)\n", freed_count, freed_bytes);
 #endif
 }
 
-static void collect_garbage(void)
+// Mostly-copying compaction. Once a full collection has swept, every cell
+// page that an ambiguous word points into is pinned: words on the stack and
+// in untyped objects. The sparse pages left unpinned are emptied by copying
+// their cells elsewhere, leaving each copy's address in the old cell. Only
+// precise slots can refer to them, the fields of typed objects and the
+// registered roots, and those are redirected before the pages are released.
+static void pin(void* ptr)
+{
+    PageInfo* page = page_map_lookup(ptr);
+    if (page && page->kind==PAGE_CELLS) page->pinned = true;
+}
+
+static void pin_words(void** start, void** end)
+{
+    for (void** p = start; p<end; ++p) {
+        pin(*p);
+    }
+}
+
+static void pin_untyped_cell(void* object, size_t size)
+{
+    PageInfo* page = page_map_lookup(object);
+    if (cell_type(page, page_cell_index(page, object))) return;
+    pin_words((void**) object, (void**) ((char*) object+size));
+}
+
+static void evacuate_cell(PageInfo* page, size_t index)
+{
+    void* cell = page_cell(page, index);
+    size_t cell_size = 0;
+    void* copy = sc_alloc(page->cell_size, page->cell_tags[index], &cell_size);
+    memcpy(copy, cell, page->cell_size);
+    *(void**) cell = copy;
+    stats.compacted_bytes += page->cell_size;
+}
+
+static void forward(void** slot)
+{
+    PageInfo* page = page_map_lookup(*slot);
+    if (!page || page->kind!=PAGE_CELLS || !page->evacuating) return;
+
+    size_t index = page_cell_index(page, *slot);
+    if (index>=page->cell_count || !page_bit(page->alloc_bits, index)) return;
+    char* cell = page_cell(page, index);
+    *slot = *(char**) cell+((char*) *slot-cell);
+}
+
+static void forward_fields(void* object, const TypeDescriptor* type)
+{
+    for (size_t i = 0; i<type->pointer_count; i++) {
+        forward((void**) ((char*) object+type->pointer_offsets[i]));
+    }
+}
+
+static void forward_typed_cell(void* object, size_t size)
+{
+    (void) size;
+    PageInfo* page = page_map_lookup(object);
+    if (page->evacuating) return;
+    const TypeDescriptor* type = cell_type(page, page_cell_index(page, object));
+    if (type) forward_fields(object, type);
+}
+
+static void pin_untyped_objects(MSHeader* list)
+{
+    for (MSHeader* header = list; header; header = header->next) {
+        if (!header->type) pin_words((void**) (header+1), (void**) ((char*) header+header->size));
+    }
+}
+
+static void forward_typed_objects(MSHeader* list)
+{
+    for (MSHeader* header = list; header; header = header->next) {
+        if (header->type) forward_fields(header+1, header->type);
+    }
+}
+
+static void forward_root(const RootEntry* root)
+{
+    char* base = root->address;
+    for (size_t i = 0; i<root->pointer_count; i++) {
+        forward(root->pointer_offsets ? (void**) (base+root->pointer_offsets[i]) : (void**) base+i);
+    }
+}
+
+static void compact_heap(void)
+{
+    clear_stack_below();
+    jmp_buf registers;
+    setjmp(registers);
+    conservative_scan_stack(pin);
+    sc_for_each_object(pin_untyped_cell);
+    pin_untyped_objects(allocation_list);
+    pin_untyped_objects(large_objects);
+
+    if (sc_begin_evacuation()>0) {
+        sc_for_each_evacuating(evacuate_cell);
+        sc_for_each_object(forward_typed_cell);
+        forward_typed_objects(allocation_list);
+        forward_typed_objects(large_objects);
+        for (size_t i = 0; i<root_count; i++) {
+            forward_root(&roots[i]);
+        }
+        for (size_t t = 0; t<root_table_count; t++) {
+            for (size_t i = 0; i<root_tables[t].count; i++) {
+                forward_root(&root_tables[t].entries[i]);
+            }
+        }
+    }
+    sc_finish_evacuation();
+}
+
+static size_t elapsed_ns(struct timespec start, struct timespec end)
+{
+    return (size_t) ((end.tv_sec-start.tv_sec)*1000000000L+(end.tv_nsec-start.tv_nsec));
+}
+
+static size_t record_pause(struct timespec start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    size_t pause = elapsed_ns(start, end);
+    telemetry_record_pause(&stats, pause);
+    return pause;
+}
+
+static void pace_next_collection(size_t live)
+{
+    if (gc_pacing) {
+        double target = (double) live*(1.0+gc_growth/100.0);
+        size_t threshold = target>=(double) gc_max_threshold ? gc_max_threshold : (size_t) target;
+        GC_THRESHOLD = threshold<gc_min_threshold ? gc_min_threshold : threshold;
+    }
+    stats.last_live_bytes = live;
+    stats.next_gc_bytes = GC_THRESHOLD;
+}
+
+// Any collection not triggered by the threshold is forced, and a forced
+// collection always sweeps the whole heap before returning.
+static void collect_garbage(GcTrigger trigger)
 {
 #ifdef DEBUG
     printf("(debug) Starting garbage collection\n");
     size_t before = stats.current_bytes;
 #endif
 
-    mark_phase();
-    sweep_phase();
+    GcRecord record = {.trigger = trigger};
+    bool forced = trigger!=GC_TRIGGER_THRESHOLD;
+    struct timespec start, marked;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // A forced collection drops any incremental cycle in progress and marks
+    // from scratch, so that it doesn't keep that cycle's floating garbage.
+    bool resume = marking && !forced;
+    if (!resume) start_marking();
+    if (markers && !resume) parallel_drain();
+    finish_marking(resume);
+    clear_remembered();
+    clock_gettime(CLOCK_MONOTONIC, &marked);
+    bool compact = (gc_mode & GC_MODE_COMPACT) && !(gc_mode & GC_MODE_GENERATIONAL);
+    bool deferred = !forced && !compact;
+    sweep_phase(deferred && (gc_mode & GC_MODE_LAZY_SWEEP), deferred && (gc_mode & GC_MODE_CONCURRENT_SWEEP), &record);
+    if (compact) compact_heap();
+    young_bytes = 0;
+    pace_next_collection(stats.current_bytes);
+
+    record.pause_ns = record_pause(start);
+    record.mark_ns = elapsed_ns(start, marked);
+    record.sweep_ns = record.pause_ns-record.mark_ns;
+    telemetry_record_collection(&stats, &record);
 
 #ifdef DEBUG
     printf("(debug) GC complete: %zu -> %zu bytes\n", before, stats.current_bytes);
 #endif
 }
 
-static void* ms_alloc(size_t size)
+// Old objects keep their mark bits and are neither traced nor freed, and the
+// survivors of the nursery are promoted in place by being marked. The sweep
+// is always eager, so the cells it frees are counted exactly.
+static void collect_minor(void)
+{
+#ifdef DEBUG
+    printf("(debug) Starting minor collection\n");
+    size_t before = stats.current_bytes;
+#endif
+
+    GcRecord record = {.trigger = GC_TRIGGER_NURSERY};
+    struct timespec start, marked;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    finish_pending_sweep();
+    mark_stack_size = 0;
+    mark_stack_overflowed = false;
+    stats.false_retained_objects = stats.false_retained_bytes = 0;
+    mark_roots();
+    scan_remembered();
+    if (markers) parallel_drain();
+    drain_mark_stack();
+    recover_from_overflow();
+    clear_remembered();
+    clock_gettime(CLOCK_MONOTONIC, &marked);
+    sweep_phase(false, false, &record);
+    young_bytes = 0;
+
+    record.pause_ns = record_pause(start);
+    record.mark_ns = elapsed_ns(start, marked);
+    record.sweep_ns = record.pause_ns-record.mark_ns;
+    telemetry_record_collection(&stats, &record);
+
+#ifdef DEBUG
+    printf("(debug) Minor collection complete: %zu -> %zu bytes\n", before, stats.current_bytes);
+#endif
+}
+
+static void start_incremental_collection(void)
+{
+#ifdef DEBUG
+    printf("(debug) Starting incremental collection\n");
+#endif
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    start_marking();
+    record_pause(start);
+}
+
+static void incremental_step(void)
+{
+    scan_mark_stack(gc_step_budget);
+    if (mark_stack_size==0) {
+        collect_garbage(GC_TRIGGER_THRESHOLD);
+    }
+}
+
+static void mark_new_object(void* object)
+{
+    PageInfo* page = page_map_lookup(object);
+    if (page->kind==PAGE_CELLS) {
+        // The root scan that started this cycle may already have found it.
+        size_t index = page_cell_index(page, object);
+        if (page_bit(page->mark_bits, index)) return;
+        page_set_bit(page->mark_bits, index);
+        marked_cells++;
+        marked_cell_bytes += page->cell_size;
+    }
+    else {
+        ((MSHeader*) object-1)->marked = true;
+    }
+}
+
+// Small objects go to the size-class heap, where mark state lives in side
+// bitmaps and no per-object header is needed. Larger ones are malloc'd
+// individually behind an MSHeader, and the largest are mapped.
+static void* allocate_object(size_t size, TypeDescriptor* type, size_t* total)
 {
-    size_t total = sizeof(MSHeader)+size;
-    MSHeader* header = malloc(total);
+    void* cell = sc_alloc(size, type_tag(type), total);
+    if (cell) {
+        cell_objects++;
+        cell_bytes += *total;
+        return cell;
+    }
+
+    *total = sizeof(MSHeader)+size;
+    bool large = *total>=LARGE_OBJECT_SIZE;
+    MSHeader* header = large ? map_large_object(*total) : malloc(*total);
     if (!header) return NULL;
 
     header->marked = false;
-    header->size = total;
-    header->next = header->prev = NULL;
+    header->remembered = false;
+    header->size = *total;
+    header->type = type;
+    if (!large) add_allocation(header);
+    return header+1;
+}
+
+static void* ms_alloc_typed(size_t size, TypeDescriptor* type)
+{
+    // The nursery is collected before the allocation that would overflow it
+    // rather than after, when the new object may only be held in a register.
+    if ((gc_mode & GC_MODE_GENERATIONAL) && !marking && young_bytes>=nursery_size) {
+        collect_minor();
+        if (stats.current_bytes>GC_THRESHOLD) collect_garbage(GC_TRIGGER_THRESHOLD);
+    }
+
+    size_t total = 0;
+    void* object = allocate_object(size, type, &total);
+    if (!object) return NULL;
 
-    add_allocation(header);
     stats.current_bytes += total;
     stats.total_allocations++;
     if (stats.current_bytes>stats.peak_bytes)
@@ -204,26 +1392,62 @@ static void* ms_alloc(size_t size)
     printf("(debug) Allocated %zu bytes\n", size);
 #endif
 
-    if (stats.current_bytes>GC_THRESHOLD) {
-        collect_garbage();
+    if (marking) {
+        mark_new_object(object);
+        incremental_step();
+    }
+    else if (gc_mode & GC_MODE_GENERATIONAL) {
+        young_bytes += total;
+    }
+    else if (stats.current_bytes>GC_THRESHOLD) {
+        if (gc_mode & GC_MODE_INCREMENTAL) {
+            start_incremental_collection();
+            mark_new_object(object);
+        }
+        else {
+            collect_garbage(GC_TRIGGER_THRESHOLD);
+        }
     }
 
-    return header+1;
+    return object;
+}
+
+static void* ms_alloc(size_t size)
+{
+    return ms_alloc_typed(size, NULL);
 }
 
 static void ms_dealloc(void* ptr)
 {
     if (!ptr) return;
 
+    PageInfo* page = page_map_lookup(ptr);
+    if (page && page->kind==PAGE_CELLS) {
+        stats.current_bytes -= page->cell_size;
+        cell_objects--;
+        cell_bytes -= page->cell_size;
+        sc_free(page, page_cell_index(page, ptr));
+        return;
+    }
+
+    // The mark stack may still hold a range inside this object.
+    if (marking) drain_mark_stack();
+
     MSHeader* header = (MSHeader*) ptr-1;
-    remove_allocation(header);
+    if (header->remembered) remembered_objects--;
     stats.current_bytes -= header->size;
+    if (page->kind==PAGE_LARGE) {
+        unmap_large_object(header);
+        return;
+    }
+    remove_allocation(header);
     free(header);
 }
 
 static void ms_gc(void)
 {
-    collect_garbage();
+    clear_stack_below();
+    collect_garbage(GC_TRIGGER_EXPLICIT);
 }
 
 static void ms_scope_end(void)
@@ -239,16 +1463,52 @@ static void ms_init(void)
 {
     stack_bottom = __builtin_frame_address(1);
     allocation_list = NULL;
+    large_objects = NULL;
+    sc_init();
     stats = (AllocatorStats) {0};
+    stats.next_gc_bytes = GC_THRESHOLD;
+    cell_objects = cell_bytes = 0;
+    marking = false;
+    young_bytes = 0;
+    dirty_page_count = 0;
+    remembered_objects = 0;
+
+    const char* threads = getenv("JBLANG_GC_THREADS");
+    if (threads) gc_threads = (unsigned) strtoul(threads, NULL, 10);
+    if (!markers) start_markers(gc_threads);
 
 #ifdef DEBUG
     printf("(debug) Mark-sweep allocator initialized\n");
 #endif
 }
 
+#ifdef DEBUG
+static void report_shutdown_free(void* object, size_t size)
+{
+    (void) object;
+    printf("(debug) Shutdown freeing %zu bytes\n", size);
+}
+#endif
+
 static void ms_shutdown(void)
 {
-    collect_garbage();
+    collect_garbage(GC_TRIGGER_SHUTDOWN);
+    stop_sweeper();
+#ifdef DEBUG
+    sc_for_each_object(report_shutdown_free);
+#endif
+    sc_shutdown();
+    free(mark_stack);
+    mark_stack = NULL;
+    mark_stack_size = mark_stack_capacity = 0;
+    free(blacklist);
+    blacklist = NULL;
+    blacklist_count = blacklist_capacity = 0;
+    stop_markers();
+    free(dirty_pages);
+    dirty_pages = NULL;
+    dirty_page_count = dirty_page_capacity = 0;
+    remembered_objects = 0;
     while (allocation_list) {
         MSHeader* next = allocation_list->next;
 #ifdef DEBUG
@@ -257,16 +1517,66 @@ static void ms_shutdown(void)
         free(allocation_list);
         allocation_list = next;
     }
+    while (large_objects) {
+#ifdef DEBUG
+        printf("(debug) Shutdown freeing %zu bytes\n", large_objects->size);
+#endif
+        unmap_large_object(large_objects);
+    }
+    page_map_clear();
+    clear_type_table();
 }
 
 static void ms_set_gc_threshold(size_t threshold)
 {
     GC_THRESHOLD = threshold;
+    gc_pacing = false;
+    stats.next_gc_bytes = threshold;
+}
+
+static void ms_set_gc_pacer(unsigned growth_percent, size_t min_bytes, size_t max_bytes)
+{
+    gc_growth = growth_percent;
+    gc_min_threshold = min_bytes;
+    gc_max_threshold = max_bytes<min_bytes ? min_bytes : max_bytes;
+    gc_pacing = true;
+    pace_next_collection(stats.last_live_bytes);
+}
+
+static void ms_set_gc_mode(unsigned modes)
+{
+    gc_mode = modes;
+}
+
+static void ms_set_gc_step_budget(size_t words)
+{
+    gc_step_budget = words ? words : 1;
+}
+
+static void ms_set_nursery_size(size_t bytes)
+{
+    nursery_size = bytes;
+}
+
+static void ms_set_gc_threads(unsigned threads)
+{
+    stop_markers();
+    start_markers(threads);
+}
+
+static void ms_write_barrier(void* field, void* value)
+{
+    if ((gc_mode & GC_MODE_GENERATIONAL) && field) remember_field(field);
+    if (!marking) return;
+
+    if (field) mark(*(void**) field);
+    mark(value);
 }
 
 static const RuntimeAllocator mark_sweep_allocator = {
         .name = "Mark-Sweep GC",
         .alloc = ms_alloc,
+        .alloc_typed = ms_alloc_typed,
         .dealloc = ms_dealloc,
         .gc = ms_gc,
         .scope_end = ms_scope_end,
@@ -276,7 +1586,14 @@ static const RuntimeAllocator mark_sweep_allocator = {
         .inc_ref_count = NULL,
         .dec_ref_count = NULL,
         .set_gc_threshold = ms_set_gc_threshold,
-        .register_root = ms_register_root
+        .set_gc_pacer = ms_set_gc_pacer,
+        .register_root = ms_register_root,
+        .register_roots = ms_register_roots,
+        .set_gc_mode = ms_set_gc_mode,
+        .set_gc_step_budget = ms_set_gc_step_budget,
+        .set_nursery_size = ms_set_nursery_size,
+        .set_gc_threads = ms_set_gc_threads,
+        .write_barrier = ms_write_barrier
 };
 
 const RuntimeAllocator* get_mark_sweep_allocator(void)
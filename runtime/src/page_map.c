@@ -0,0 +1,272 @@
+#define _POSIX_C_SOURCE 200112L
+#include "page_map.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+// Three-level radix tree over page numbers, 12 bits per level, which covers
+// a 48-bit address space. Interior nodes are only allocated for address
+// ranges the heap actually uses.
+#define LEVEL_BITS 12
+#define LEVEL_SIZE ((size_t) 1<<LEVEL_BITS)
+#define LEVEL_MASK (LEVEL_SIZE-1)
+#define MAX_PAGE_BITS (3*LEVEL_BITS)
+
+typedef struct PageLeaf {
+  PageInfo* pages[LEVEL_SIZE];
+} PageLeaf;
+
+typedef struct PageNode {
+  PageLeaf* leaves[LEVEL_SIZE];
+} PageNode;
+
+static PageNode* root[LEVEL_SIZE];
+
+// Cheap filter applied before the tree walk; most words on the stack are
+// nowhere near the heap.
+static uintptr_t lowest_address = UINTPTR_MAX;
+static uintptr_t highest_address = 0;
+
+// A background sweep can drop emptied cell pages while the program registers
+// new objects. Lookups don't lock: the program only looks up pages that hold
+// live objects, which no sweep touches, and individual objects are only
+// unregistered while the program is stopped for a collection.
+static pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static PageInfo** page_slot(uintptr_t page, int create)
+{
+    if (page>>MAX_PAGE_BITS) return NULL;
+
+    size_t i1 = (page>>(2*LEVEL_BITS)) & LEVEL_MASK;
+    size_t i2 = (page>>LEVEL_BITS) & LEVEL_MASK;
+    size_t i3 = page & LEVEL_MASK;
+
+    PageNode* node = root[i1];
+    if (!node) {
+        if (!create) return NULL;
+        node = calloc(1, sizeof(PageNode));
+        if (!node) return NULL;
+        root[i1] = node;
+    }
+    PageLeaf* leaf = node->leaves[i2];
+    if (!leaf) {
+        if (!create) return NULL;
+        leaf = calloc(1, sizeof(PageLeaf));
+        if (!leaf) return NULL;
+        node->leaves[i2] = leaf;
+    }
+    return &leaf->pages[i3];
+}
+
+static PageInfo* page_acquire(uintptr_t page)
+{
+    PageInfo** slot = page_slot(page, 1);
+    if (!slot) {
+        printf("Failed to allocate page map entry.");
+        exit(1);
+    }
+    if (!*slot) {
+        *slot = calloc(1, sizeof(PageInfo));
+        if (!*slot) {
+            printf("Failed to allocate page map entry.");
+            exit(1);
+        }
+    }
+    (*slot)->objects++;
+    return *slot;
+}
+
+static PageInfo* page_release(uintptr_t page)
+{
+    PageInfo** slot = page_slot(page, 0);
+    if (!slot || !*slot) return NULL;
+
+    PageInfo* info = *slot;
+    if (--info->objects==0) {
+        free(info);
+        *slot = NULL;
+        return NULL;
+    }
+    return info;
+}
+
+void page_map_insert(void* start, size_t size)
+{
+    uintptr_t addr = (uintptr_t) start;
+    uintptr_t last = addr+size-1;
+    uintptr_t first_page = addr>>PAGE_SHIFT;
+    uintptr_t last_page = last>>PAGE_SHIFT;
+
+    pthread_mutex_lock(&map_lock);
+    PageInfo* info = page_acquire(first_page);
+    size_t granule = (addr & (PAGE_SIZE-1))/PAGE_GRANULE;
+    info->starts[granule/64] |= (uint64_t) 1<<(granule%64);
+
+    for (uintptr_t page = first_page+1; page<=last_page; page++) {
+        page_acquire(page)->spanning = start;
+    }
+
+    if (addr<lowest_address) lowest_address = addr;
+    if (last>highest_address) highest_address = last;
+    pthread_mutex_unlock(&map_lock);
+}
+
+void page_map_remove(void* start, size_t size)
+{
+    uintptr_t addr = (uintptr_t) start;
+    uintptr_t first_page = addr>>PAGE_SHIFT;
+    uintptr_t last_page = (addr+size-1)>>PAGE_SHIFT;
+
+    pthread_mutex_lock(&map_lock);
+    PageInfo* info = page_map_lookup(start);
+    if (info) {
+        size_t granule = (addr & (PAGE_SIZE-1))/PAGE_GRANULE;
+        info->starts[granule/64] &= ~((uint64_t) 1<<(granule%64));
+    }
+    page_release(first_page);
+
+    for (uintptr_t page = first_page+1; page<=last_page; page++) {
+        info = page_map_lookup((void*) (page<<PAGE_SHIFT));
+        if (info && info->spanning==start) info->spanning = NULL;
+        page_release(page);
+    }
+    pthread_mutex_unlock(&map_lock);
+}
+
+PageInfo* page_map_add_page(void* page)
+{
+    pthread_mutex_lock(&map_lock);
+    PageInfo** slot = page_slot((uintptr_t) page>>PAGE_SHIFT, 1);
+    PageInfo* info = slot ? calloc(1, sizeof(PageInfo)) : NULL;
+    if (!info) {
+        printf("Failed to allocate page map entry.");
+        exit(1);
+    }
+    info->kind = PAGE_CELLS;
+    info->base = page;
+    *slot = info;
+
+    uintptr_t addr = (uintptr_t) page;
+    if (addr<lowest_address) lowest_address = addr;
+    if (addr+PAGE_SIZE-1>highest_address) highest_address = addr+PAGE_SIZE-1;
+    pthread_mutex_unlock(&map_lock);
+    return info;
+}
+
+void page_map_remove_page(void* page)
+{
+    pthread_mutex_lock(&map_lock);
+    PageInfo** slot = page_slot((uintptr_t) page>>PAGE_SHIFT, 0);
+    if (slot && *slot) {
+        free(*slot);
+        *slot = NULL;
+    }
+    pthread_mutex_unlock(&map_lock);
+}
+
+PageInfo* page_map_add_span(void* start, size_t size)
+{
+    uintptr_t addr = (uintptr_t) start;
+    uintptr_t first_page = addr>>PAGE_SHIFT;
+    uintptr_t last_page = (addr+size-1)>>PAGE_SHIFT;
+    PageInfo* info = calloc(1, sizeof(PageInfo));
+    if (!info) {
+        printf("Failed to allocate page map entry.");
+        exit(1);
+    }
+    info->kind = PAGE_LARGE;
+    info->base = start;
+    info->objects = 1;
+
+    pthread_mutex_lock(&map_lock);
+    for (uintptr_t page = first_page; page<=last_page; page++) {
+        PageInfo** slot = page_slot(page, 1);
+        if (!slot) {
+            printf("Failed to allocate page map entry.");
+            exit(1);
+        }
+        *slot = info;
+    }
+    if (addr<lowest_address) lowest_address = addr;
+    if (addr+size-1>highest_address) highest_address = addr+size-1;
+    pthread_mutex_unlock(&map_lock);
+    return info;
+}
+
+void page_map_remove_span(void* start, size_t size)
+{
+    uintptr_t addr = (uintptr_t) start;
+    uintptr_t first_page = addr>>PAGE_SHIFT;
+    uintptr_t last_page = (addr+size-1)>>PAGE_SHIFT;
+
+    pthread_mutex_lock(&map_lock);
+    PageInfo* info = NULL;
+    for (uintptr_t page = first_page; page<=last_page; page++) {
+        PageInfo** slot = page_slot(page, 0);
+        if (!slot) continue;
+        info = *slot;
+        *slot = NULL;
+    }
+    free(info);
+    pthread_mutex_unlock(&map_lock);
+}
+
+PageInfo* page_map_lookup(const void* addr)
+{
+    if ((uintptr_t) addr<lowest_address || (uintptr_t) addr>highest_address) return NULL;
+
+    PageInfo** slot = page_slot((uintptr_t) addr>>PAGE_SHIFT, 0);
+    return slot ? *slot : NULL;
+}
+
+bool page_map_in_range(const void* addr)
+{
+    return (uintptr_t) addr>=lowest_address && (uintptr_t) addr<=highest_address;
+}
+
+void* page_find_object(const PageInfo* page, const void* ptr)
+{
+    // Nearest object start at or below ptr within its own page.
+    uintptr_t addr = (uintptr_t) ptr;
+    uintptr_t base = addr & ~(uintptr_t) (PAGE_SIZE-1);
+    size_t granule = (addr-base)/PAGE_GRANULE;
+    size_t word = granule/64;
+    size_t bit = granule%64;
+    uint64_t bits = page->starts[word] & (bit==63 ? ~(uint64_t) 0 : (((uint64_t) 1<<(bit+1))-1));
+    for (;;) {
+        if (bits) {
+            size_t found = word*64+63-__builtin_clzll(bits);
+            return (void*) (base+found*PAGE_GRANULE);
+        }
+        if (word==0) break;
+        bits = page->starts[--word];
+    }
+
+    // Otherwise only an object from an earlier page can cover it.
+    return page->spanning;
+}
+
+void page_map_clear(void)
+{
+    for (size_t i = 0; i<LEVEL_SIZE; i++) {
+        PageNode* node = root[i];
+        if (!node) continue;
+        for (size_t j = 0; j<LEVEL_SIZE; j++) {
+            PageLeaf* leaf = node->leaves[j];
+            if (!leaf) continue;
+            for (size_t k = 0; k<LEVEL_SIZE; k++) {
+                // A span's shared entry is freed from its first page only.
+                PageInfo* info = leaf->pages[k];
+                uintptr_t page = (i<<(2*LEVEL_BITS))|(j<<LEVEL_BITS)|k;
+                if (info && info->kind==PAGE_LARGE && (uintptr_t) info->base>>PAGE_SHIFT!=page) continue;
+                free(info);
+            }
+            free(leaf);
+        }
+        free(node);
+        root[i] = NULL;
+    }
+    lowest_address = UINTPTR_MAX;
+    highest_address = 0;
+}
@@ -1,9 +1,17 @@
+#define _POSIX_C_SOURCE 200112L
 #include "reference_count_allocator.h"
+#include "reference_count_header.h"
+#include "gc_telemetry.h"
+#include <limits.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 
-static AllocatorStats stats = {0};
+AllocatorStats rc_stats = {0};
 
 typedef void (* deallocatorFunc)(void*);
 typedef struct deallocator {
@@ -11,63 +19,1037 @@ typedef struct deallocator {
   struct deallocator* next;
 } deallocator;
 
-typedef struct RefcountHeader {
-  long long count;
-  size_t size;
-  void* to_free[3];
-  int idx;
-} RefcountHeader;
+// The owner's count has been merged into shared, which now holds them all.
+#define SHARED_MERGED 1LL
+// shared went below zero before the merge, so the object sits in its owner's
+// queue. Only whoever takes it off the queue may free it.
+#define SHARED_QUEUED 2LL
+#define SHARED_ONE 4LL
 
-static void* rc_alloc(size_t bytes)
+// Cells are carved out of chunks and recycled through a free list per size
+// class, so that objects are allocated and freed without calling into libc.
+// Bigger objects are left to malloc. Each thread keeps its own lists, and
+// what it still holds when it exits goes to the orphans for others to pick
+// up. Chunks are only returned at shutdown.
+#define POOL_GRANULE 16
+#define POOL_MAX_SIZE 1024
+#define CHUNK_SIZE (64*1024)
+
+static const size_t class_sizes[] = {
+        16, 32, 48, 64, 80, 96, 112, 128,
+        160, 192, 224, 256, 320, 384, 448, 512,
+        640, 768, 1024
+};
+#define NUM_CLASSES (sizeof(class_sizes)/sizeof(class_sizes[0]))
+#define LARGE_CLASS NUM_CLASSES
+
+typedef struct FreeCell {
+  struct FreeCell* next;
+} FreeCell;
+
+typedef struct Pool {
+  FreeCell* free_list;
+  char* bump;
+  char* bump_limit;
+} Pool;
+
+// The first cell's worth of each chunk links it to the next.
+typedef struct Chunk {
+  struct Chunk* next;
+} Chunk;
+
+static __thread Pool pools[NUM_CLASSES];
+static unsigned char class_for_granules[POOL_MAX_SIZE/POOL_GRANULE+1];
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static FreeCell* orphans[NUM_CLASSES];
+static Chunk* chunks = NULL;
+
+typedef struct HeaderStack {
+  RefcountHeader** items;
+  size_t count;
+  size_t capacity;
+} HeaderStack;
+
+// Objects whose count has reached zero, waiting for their fields to be
+// released and their memory freed. Working through this stack instead of
+// recursing keeps the C stack flat however long the chain of objects that
+// die together, and lets a budget spread a big cascade over later operations.
+static __thread HeaderStack pending = {0};
+static size_t free_budget = 0;
+static __thread bool draining = false;
+
+// Objects whose count dropped without reaching zero, which may be all that
+// keeps a garbage cycle alive. They are tested in batches once cycle_buffer
+// of them have built up.
+static HeaderStack roots = {0};
+static size_t cycle_buffer = 4096;
+// Work for the cycle collector's traversals, and the garbage they find.
+static HeaderStack work = {0};
+static HeaderStack blacken = {0};
+static HeaderStack garbage = {0};
+
+// Under GC_MODE_DEFERRED only the references one heap object holds to
+// another are counted. An object whose count is zero, from its allocation or
+// since, may still be held by a local or a global, so it waits in the zero
+// count table until a reconciliation looks for it on the stack and in the
+// registered roots. One runs once zct_limit more objects are waiting, on
+// runtime_gc and at shutdown.
+static bool deferred = false;
+static HeaderStack zct = {0};
+static size_t zct_limit = 4096;
+static size_t next_reconcile = 4096;
+// Words a reconciliation found on the stack and in the globals.
+static void** held_words = NULL;
+static size_t held_count = 0;
+static size_t held_capacity = 0;
+// Set by the program, through runtime_set_stack_bottom.
+static void* stack_bottom = NULL;
+
+// Globals, registered one at a time or as whole tables, which are kept by
+// reference.
+typedef struct RootTable {
+  const RootEntry* entries;
+  size_t count;
+} RootTable;
+
+static RootEntry* root_entries = NULL;
+static size_t root_entry_count = 0;
+static size_t root_entry_capacity = 0;
+static RootTable* root_tables = NULL;
+static size_t root_table_count = 0;
+static size_t root_table_capacity = 0;
+
+#ifdef RC_COMPACT_HEADER
+static const bool rc_thread_safe = false;
+
+// Descriptors of the types allocated so far, indexed by the tag in each
+// header. Tag 0 is left for untyped objects.
+static const TypeDescriptor** type_table = NULL;
+static size_t type_count = 0;
+static size_t type_capacity = 0;
+#else
+bool rc_thread_safe = false;
+
+// A thread that has allocated under GC_MODE_THREAD_SAFE, and the objects it
+// owns whose shared count went below zero. Those may be dead, but only the
+// owner can tell, so it merges them at its next allocation, scope end or
+// collection, or when it exits. After that, whoever would have queued an
+// object merges it.
+typedef struct ThreadState {
+  pthread_mutex_t lock;
+  HeaderStack queue;
+  size_t queued;
+  bool exited;
+} ThreadState;
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static ThreadState** thread_states = NULL;
+static size_t thread_count = 0;
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+// Ids are positions in thread_states plus one. A thread that has never
+// allocated has none, and matches no owner.
+#define NO_THREAD UINT_MAX
+static __thread unsigned self_id = NO_THREAD;
+static __thread ThreadState* self = NULL;
+#endif
+
+// Reference count operations made under GC_MODE_THREAD_SAFE, counted apart
+// so that threads don't contend for the rc_stats. They are added in when the
+// thread exits or asks for the rc_stats.
+typedef struct ThreadOps {
+  size_t increments;
+  size_t decrements;
+  size_t shared_updates;
+} ThreadOps;
+
+static __thread ThreadOps thread_ops = {0};
+
+static void push_header(HeaderStack* stack, RefcountHeader* header)
+{
+    if (stack->count==stack->capacity) {
+        size_t capacity = stack->capacity ? stack->capacity*2 : 64;
+        RefcountHeader** grown = realloc(stack->items, capacity*sizeof(RefcountHeader*));
+        if (!grown) {
+            printf("Failed to grow a reference count stack.\n");
+            exit(1);
+        }
+        stack->items = grown;
+        stack->capacity = capacity;
+    }
+    stack->items[stack->count++] = header;
+}
+
+static void free_stack(HeaderStack* stack)
+{
+    free(stack->items);
+    *stack = (HeaderStack) {0};
+}
+
+static void* grow_array(void* array, size_t* capacity, size_t element_size)
+{
+    size_t grown_capacity = *capacity ? *capacity*2 : 16;
+    void* grown = realloc(array, grown_capacity*element_size);
+    if (!grown) {
+        printf("Failed to grow a root table.\n");
+        exit(1);
+    }
+    *capacity = grown_capacity;
+    return grown;
+}
+
+#ifdef RC_COMPACT_HEADER
+static uint16_t type_tag(TypeDescriptor* type)
+{
+    if (!type) return 0;
+    if (type->tag) return (uint16_t) type->tag;
+    if (type_count>UINT16_MAX) {
+        printf("Too many types for compact reference count headers.\n");
+        exit(1);
+    }
+    if (type_count==type_capacity) {
+        size_t capacity = type_capacity ? type_capacity*2 : 64;
+        const TypeDescriptor** grown = realloc(type_table, capacity*sizeof(TypeDescriptor*));
+        if (!grown) {
+            printf("Failed to grow the type table.\n");
+            exit(1);
+        }
+        type_table = grown;
+        type_capacity = capacity;
+    }
+    if (type_count==0) type_table[type_count++] = NULL;
+    type_table[type_count] = type;
+    type->tag = (unsigned) type_count;
+    return (uint16_t) type_count++;
+}
+
+static void clear_type_table(void)
+{
+    for (size_t i = 1; i<type_count; i++) {
+        ((TypeDescriptor*) type_table[i])->tag = 0;
+    }
+    free(type_table);
+    type_table = NULL;
+    type_count = type_capacity = 0;
+}
+
+static const TypeDescriptor* header_type(const RefcountHeader* header)
+{
+    return type_table ? type_table[header->tag] : NULL;
+}
+
+static size_t header_size(const RefcountHeader* header)
+{
+    if (header->size_class==LARGE_CLASS) return ((const size_t*) header)[-1];
+    return class_sizes[header->size_class];
+}
+
+static bool buffered(const RefcountHeader* header)
+{
+    return header->buffered;
+}
+
+static void set_root_slot(RefcountHeader* header, size_t slot)
+{
+    header->buffered = slot!=0;
+}
+#else
+static const TypeDescriptor* header_type(const RefcountHeader* header)
+{
+    return header->type;
+}
+
+static size_t header_size(const RefcountHeader* header)
+{
+    return header->size;
+}
+
+static bool buffered(const RefcountHeader* header)
+{
+    return header->root_slot!=0;
+}
+
+static void set_root_slot(RefcountHeader* header, size_t slot)
+{
+    header->root_slot = (unsigned) slot;
+}
+#endif
+
+static void init_classes(void)
+{
+    unsigned c = 0;
+    for (size_t g = 0; g<=POOL_MAX_SIZE/POOL_GRANULE; g++) {
+        while (class_sizes[c]<g*POOL_GRANULE) c++;
+        class_for_granules[g] = (unsigned char) c;
+    }
+}
+
+static size_t class_of(size_t size)
+{
+    return class_for_granules[(size+POOL_GRANULE-1)/POOL_GRANULE];
+}
+
+static void refill(Pool* pool, size_t class)
+{
+    pthread_mutex_lock(&pool_lock);
+    pool->free_list = orphans[class];
+    orphans[class] = NULL;
+    if (!pool->free_list) {
+        Chunk* chunk = malloc(CHUNK_SIZE);
+        if (!chunk) {
+            printf("Failed to allocate a reference count chunk.\n");
+            exit(1);
+        }
+        chunk->next = chunks;
+        chunks = chunk;
+        pool->bump = (char*) chunk+POOL_GRANULE;
+        pool->bump_limit = (char*) chunk+CHUNK_SIZE;
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+static void* take_cell(size_t class)
+{
+    Pool* pool = &pools[class];
+    if (!pool->free_list && (size_t) (pool->bump_limit-pool->bump)<class_sizes[class]) {
+        refill(pool, class);
+    }
+    FreeCell* cell = pool->free_list;
+    if (cell) {
+        pool->free_list = cell->next;
+        return cell;
+    }
+    void* bumped = pool->bump;
+    pool->bump += class_sizes[class];
+    return bumped;
+}
+
+static void give_cell(size_t class, void* memory)
+{
+    FreeCell* cell = memory;
+    cell->next = pools[class].free_list;
+    pools[class].free_list = cell;
+}
+
+#ifndef RC_COMPACT_HEADER
+// Hands this thread's free cells over to the orphans. What is left of the
+// chunks it was carving stays unused until shutdown.
+static void orphan_cells(void)
+{
+    pthread_mutex_lock(&pool_lock);
+    for (size_t i = 0; i<NUM_CLASSES; i++) {
+        FreeCell* cell = pools[i].free_list;
+        while (cell) {
+            FreeCell* next = cell->next;
+            cell->next = orphans[i];
+            orphans[i] = cell;
+            cell = next;
+        }
+        pools[i] = (Pool) {0};
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+#endif
+
+static void free_chunks(void)
+{
+    pthread_mutex_lock(&pool_lock);
+    while (chunks) {
+        Chunk* next = chunks->next;
+        free(chunks);
+        chunks = next;
+    }
+    memset(orphans, 0, sizeof(orphans));
+    memset(pools, 0, sizeof(pools));
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// A zeroed header with room for bytes behind it, from a pool when it fits
+// in a class. *size is what the object takes up.
+static RefcountHeader* new_header(size_t bytes, size_t* size)
+{
+    size_t needed = bytes+sizeof(RefcountHeader);
+    if (needed<=POOL_MAX_SIZE) {
+        size_t class = class_of(needed);
+        *size = class_sizes[class];
+        RefcountHeader* header = take_cell(class);
+        memset(header, 0, *size);
+#ifdef RC_COMPACT_HEADER
+        header->size_class = (unsigned char) class;
+#endif
+        return header;
+    }
+#ifdef RC_COMPACT_HEADER
+    *size = needed+sizeof(size_t);
+    size_t* memory = calloc(1, *size);
+    if (!memory) return NULL;
+    memory[0] = *size;
+    RefcountHeader* header = (RefcountHeader*) (memory+1);
+    header->size_class = LARGE_CLASS;
+    return header;
+#else
+    *size = needed;
+    return calloc(1, needed);
+#endif
+}
+
+static void free_header(RefcountHeader* header, size_t size)
+{
+    if (size<=POOL_MAX_SIZE) {
+        give_cell(class_of(size), header);
+        return;
+    }
+#ifdef RC_COMPACT_HEADER
+    free((size_t*) header-1);
+#else
+    free(header);
+#endif
+}
+
+static size_t child_count(const RefcountHeader* header)
+{
+    const TypeDescriptor* type = header_type(header);
+    return type ? type->pointer_count : 0;
+}
+
+static RefcountHeader* child_header(RefcountHeader* header, size_t i)
+{
+    void* child = *(void**) ((char*) (header+1)+header_type(header)->pointer_offsets[i]);
+    return child ? (RefcountHeader*) child-1 : NULL;
+}
+
+// What an object goes back to outside cycle collection.
+static unsigned char live_color(const RefcountHeader* header)
+{
+    return child_count(header)==0 ? RC_COLOR_GREEN : RC_COLOR_BLACK;
+}
+
+static void buffer_root(RefcountHeader* header)
 {
-    size_t size = bytes+sizeof(RefcountHeader);
-    RefcountHeader* ptr = malloc(size);
-    *ptr = (RefcountHeader) {
-            .count = 1,
-            .size = size,
-            .to_free = {0, 0, 0},
-            .idx = 0,
-    };
-    if (ptr) {
-        stats.total_allocations++;
-        stats.current_bytes += size;
-        if (stats.current_bytes>stats.peak_bytes) {
-            stats.peak_bytes = stats.current_bytes;
+    push_header(&roots, header);
+    set_root_slot(header, roots.count);
+    rc_stats.cycle_roots = roots.count;
+}
+
+#ifndef RC_COMPACT_HEADER
+// Takes a dead object out of the root buffer straight away, rather than
+// keeping its memory until the next collection.
+static void unbuffer_root(RefcountHeader* header)
+{
+    RefcountHeader* last = roots.items[--roots.count];
+    roots.items[header->root_slot-1] = last;
+    last->root_slot = header->root_slot;
+    header->root_slot = 0;
+    rc_stats.cycle_roots = roots.count;
+}
+#endif
+
+static void count_allocation(size_t size)
+{
+    if (!rc_thread_safe) {
+        rc_stats.total_allocations++;
+        rc_stats.current_bytes += size;
+        if (rc_stats.current_bytes>rc_stats.peak_bytes) {
+            rc_stats.peak_bytes = rc_stats.current_bytes;
         }
+        return;
+    }
+    __atomic_add_fetch(&rc_stats.total_allocations, 1, __ATOMIC_RELAXED);
+    size_t current = __atomic_add_fetch(&rc_stats.current_bytes, size, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&rc_stats.peak_bytes, __ATOMIC_RELAXED);
+    while (current>peak && !__atomic_compare_exchange_n(&rc_stats.peak_bytes, &peak, current, true,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static void free_object(RefcountHeader* header)
+{
+    size_t size = header_size(header);
+    if (!rc_thread_safe) {
+        rc_stats.total_objects_freed++;
+        rc_stats.total_bytes_freed += size;
+        rc_stats.current_bytes -= size;
+    }
+    else {
+        __atomic_add_fetch(&rc_stats.total_objects_freed, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&rc_stats.total_bytes_freed, size, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&rc_stats.current_bytes, size, __ATOMIC_RELAXED);
     }
-    return ptr+1;
+    free_header(header, size);
+}
+
+static void fold_thread_ops(void)
+{
+    __atomic_add_fetch(&rc_stats.total_increments, thread_ops.increments, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&rc_stats.total_decrements, thread_ops.decrements, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&rc_stats.shared_updates, thread_ops.shared_updates, __ATOMIC_RELAXED);
+    thread_ops = (ThreadOps) {0};
+}
+
+// Frees up to limit pending objects, or all of them when limit is 0. The
+// counts a release drops to zero join the stack rather than being freed by a
+// nested drain.
+static void drain_pending(size_t limit)
+{
+    if (draining) return;
+    draining = true;
+    for (size_t freed = 0; pending.count>0 && (limit==0 || freed<limit); freed++) {
+        RefcountHeader* header = pending.items[--pending.count];
+        const TypeDescriptor* type = header_type(header);
+        if (type && type->release) {
+            type->release(header+1);
+        }
+#ifdef RC_COMPACT_HEADER
+        if (header->buffered) {
+            header->color = RC_COLOR_RELEASED;
+            continue;
+        }
+#else
+        if (header->root_slot) unbuffer_root(header);
+#endif
+        free_object(header);
+    }
+    draining = false;
+}
+
+static void defer(RefcountHeader* header)
+{
+    header->zct = 1;
+    push_header(&zct, header);
+}
+
+void rc_release(RefcountHeader* header)
+{
+    if (deferred) {
+        if (!header->zct) defer(header);
+        return;
+    }
+    push_header(&pending, header);
+    drain_pending(free_budget);
+}
+
+// Takes a count off everything the gray subgraph under root points to, so
+// that whatever is left over comes from outside it.
+static void mark_gray(RefcountHeader* root)
+{
+    if (root->color==RC_COLOR_GRAY) return;
+    root->color = RC_COLOR_GRAY;
+    push_header(&work, root);
+    while (work.count>0) {
+        RefcountHeader* header = work.items[--work.count];
+        for (size_t i = 0; i<child_count(header); i++) {
+            RefcountHeader* child = child_header(header, i);
+            if (!child) continue;
+            child->count--;
+            if (child->color!=RC_COLOR_GRAY) {
+                child->color = RC_COLOR_GRAY;
+                push_header(&work, child);
+            }
+        }
+    }
+}
+
+// Referenced from outside after all: gives back the counts mark_gray took
+// from everything reachable from it.
+static void scan_black(RefcountHeader* root)
+{
+    root->color = live_color(root);
+    push_header(&blacken, root);
+    while (blacken.count>0) {
+        RefcountHeader* header = blacken.items[--blacken.count];
+        for (size_t i = 0; i<child_count(header); i++) {
+            RefcountHeader* child = child_header(header, i);
+            if (!child) continue;
+            child->count++;
+            if (child->color==RC_COLOR_GRAY || child->color==RC_COLOR_WHITE) {
+                child->color = live_color(child);
+                push_header(&blacken, child);
+            }
+        }
+    }
+}
+
+static void scan(RefcountHeader* root)
+{
+    push_header(&work, root);
+    while (work.count>0) {
+        RefcountHeader* header = work.items[--work.count];
+        if (header->color!=RC_COLOR_GRAY) continue;
+        if (header->count>0) {
+            scan_black(header);
+            continue;
+        }
+        header->color = RC_COLOR_WHITE;
+        for (size_t i = 0; i<child_count(header); i++) {
+            RefcountHeader* child = child_header(header, i);
+            if (child) push_header(&work, child);
+        }
+    }
+}
+
+// Gathers the white objects reachable from root. Their references to objects
+// that survive were already taken off by mark_gray. They are only freed once
+// every root has been through here, as later ones may still point at them.
+static void collect_white(RefcountHeader* root)
+{
+    if (root->color!=RC_COLOR_WHITE || buffered(root)) return;
+    root->color = RC_COLOR_BLACK;
+    push_header(&work, root);
+    while (work.count>0) {
+        RefcountHeader* header = work.items[--work.count];
+        for (size_t i = 0; i<child_count(header); i++) {
+            RefcountHeader* child = child_header(header, i);
+            if (child && child->color==RC_COLOR_WHITE && !buffered(child)) {
+                child->color = RC_COLOR_BLACK;
+                push_header(&work, child);
+            }
+        }
+        push_header(&garbage, header);
+    }
+}
+
+static size_t elapsed_ns(struct timespec start, struct timespec end)
+{
+    return (size_t) ((end.tv_sec-start.tv_sec)*1000000000L+(end.tv_nsec-start.tv_nsec));
+}
+
+// Trial deletion over the buffered roots: the subgraph under them is
+// discounted for its own internal references, and what nothing outside it
+// still references is a garbage cycle.
+static void collect_cycles(GcTrigger trigger)
+{
+    GcRecord record = {.trigger = trigger};
+    struct timespec start, scanned, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    size_t kept = 0;
+    for (size_t i = 0; i<roots.count; i++) {
+        RefcountHeader* header = roots.items[i];
+        // Anything else is back in use, or dead and waiting to be released.
+        if (header->color!=RC_COLOR_PURPLE || header->count==0) {
+            set_root_slot(header, 0);
+            if (header->color==RC_COLOR_RELEASED) free_object(header);
+            continue;
+        }
+        mark_gray(header);
+        roots.items[kept++] = header;
+        set_root_slot(header, kept);
+    }
+    roots.count = kept;
+    for (size_t i = 0; i<roots.count; i++) {
+        scan(roots.items[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &scanned);
+
+    for (size_t i = 0; i<roots.count; i++) {
+        set_root_slot(roots.items[i], 0);
+        collect_white(roots.items[i]);
+    }
+    roots.count = 0;
+    for (size_t i = 0; i<garbage.count; i++) {
+        size_t size = header_size(garbage.items[i]);
+        record.objects_freed++;
+        record.bytes_freed += size;
+        rc_stats.current_bytes -= size;
+        free_header(garbage.items[i], size);
+    }
+    garbage.count = 0;
+    rc_stats.cycle_roots = 0;
+    rc_stats.cycle_objects_freed += record.objects_freed;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    record.mark_ns = elapsed_ns(start, scanned);
+    record.pause_ns = elapsed_ns(start, end);
+    record.sweep_ns = record.pause_ns-record.mark_ns;
+    record.bytes_marked = rc_stats.current_bytes;
+    telemetry_record_pause(&rc_stats, record.pause_ns);
+    telemetry_record_collection(&rc_stats, &record);
+}
+
+// A count dropped but not to zero, which may have left a cycle with no
+// references from outside. Only black objects can be in one: purple ones are
+// buffered already and green ones hold no counted references. An increment
+// leaves the color alone, so an object stays buffered until the collector
+// finds it in use.
+void rc_possible_root(RefcountHeader* header)
+{
+    if (header->color!=RC_COLOR_BLACK || deferred) return;
+    header->color = RC_COLOR_PURPLE;
+    if (!buffered(header)) buffer_root(header);
+    if (roots.count>=cycle_buffer && !draining) collect_cycles(GC_TRIGGER_THRESHOLD);
+}
+
+static int compare_words(const void* a, const void* b)
+{
+    uintptr_t left = *(const uintptr_t*) a;
+    uintptr_t right = *(const uintptr_t*) b;
+    return left<right ? -1 : left>right;
+}
+
+static void hold(void* word)
+{
+    if (held_count==held_capacity) held_words = grow_array(held_words, &held_capacity, sizeof(void*));
+    held_words[held_count++] = word;
+}
+
+static void hold_root(const RootEntry* root)
+{
+    for (size_t i = 0; i<root->pointer_count; i++) {
+        size_t offset = root->pointer_offsets ? root->pointer_offsets[i] : i*sizeof(void*);
+        hold(*(void**) ((char*) root->address+offset));
+    }
+}
+
+static void __attribute__((noinline)) hold_stack(void)
+{
+    if (!stack_bottom) {
+        printf("Deferred reference counting needs runtime_set_stack_bottom.\n");
+        exit(1);
+    }
+    void** bottom = (void**) stack_bottom;
+    void** top = (void**) __builtin_frame_address(0);
+    if (top<bottom) {
+        for (void** p = top; p<bottom; ++p) {
+            hold(*p);
+        }
+    }
+    else {
+        for (void** p = bottom; p<top; ++p) {
+            hold(*p);
+        }
+    }
+}
+
+// Gathers every word the globals and the stack hold, sorted, so that the
+// objects they may point into can be looked up.
+static void __attribute__((noinline)) hold_roots(void)
+{
+    // Pointers held only in callee-saved registers, such as an object
+    // allocated just before, are spilled where the stack scan will see them.
+    jmp_buf registers;
+    setjmp(registers);
+    held_count = 0;
+    for (size_t i = 0; i<root_entry_count; i++) {
+        hold_root(&root_entries[i]);
+    }
+    for (size_t t = 0; t<root_table_count; t++) {
+        for (size_t i = 0; i<root_tables[t].count; i++) {
+            hold_root(&root_tables[t].entries[i]);
+        }
+    }
+    hold_stack();
+    qsort(held_words, held_count, sizeof(void*), compare_words);
+}
+
+// Whether any held word points into the object, its header included.
+static bool held(const RefcountHeader* header)
+{
+    size_t low = 0;
+    size_t high = held_count;
+    while (low<high) {
+        size_t middle = low+(high-low)/2;
+        if ((uintptr_t) held_words[middle]<(uintptr_t) header) low = middle+1;
+        else high = middle;
+    }
+    return low<held_count && (uintptr_t) held_words[low]<(uintptr_t) header+header_size(header);
+}
+
+// Deutsch and Bobrow's reconciliation. Whatever in the table is still at zero
+// and isn't held from the stack or a global is garbage. Releasing it can
+// bring more counts to zero, and those objects are looked up against the same
+// words, which no release can change. At shutdown nothing is held any more,
+// and nothing is scanned.
+static void reconcile(GcTrigger trigger, bool scan_roots)
+{
+    GcRecord record = {.trigger = trigger};
+    struct timespec start, scanned, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t objects_freed = rc_stats.total_objects_freed;
+    size_t bytes_freed = rc_stats.total_bytes_freed;
+    held_count = 0;
+    if (scan_roots) hold_roots();
+    clock_gettime(CLOCK_MONOTONIC, &scanned);
+
+    // Objects held from the heap leave the table until their count drops to
+    // zero again. Those held only from outside it stay, at the front.
+    size_t kept = 0;
+    size_t next = 0;
+    while (next<zct.count) {
+        for (; next<zct.count; next++) {
+            RefcountHeader* header = zct.items[next];
+            if (header->count>0) {
+                header->zct = 0;
+            }
+            else if (held(header)) {
+                zct.items[kept++] = header;
+            }
+            else {
+                header->zct = 0;
+                push_header(&pending, header);
+            }
+        }
+        zct.count = next = kept;
+        drain_pending(0);
+    }
+    next_reconcile = zct.count+zct_limit;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    record.mark_ns = elapsed_ns(start, scanned);
+    record.pause_ns = elapsed_ns(start, end);
+    record.sweep_ns = record.pause_ns-record.mark_ns;
+    record.objects_freed = rc_stats.total_objects_freed-objects_freed;
+    record.bytes_freed = rc_stats.total_bytes_freed-bytes_freed;
+    record.bytes_marked = rc_stats.current_bytes;
+    // The record adds what was freed back in.
+    rc_stats.total_objects_freed = objects_freed;
+    rc_stats.total_bytes_freed = bytes_freed;
+    telemetry_record_pause(&rc_stats, record.pause_ns);
+    telemetry_record_collection(&rc_stats, &record);
+}
+
+#ifdef RC_COMPACT_HEADER
+static void merge_queue(void)
+{
+}
+
+static void free_thread_states(void)
+{
+}
+#else
+static long long shared_count(long long shared)
+{
+    return (shared & ~(SHARED_ONE-1))/SHARED_ONE;
+}
+
+// Folds the owner's count into the shared one, after which every thread goes
+// through shared. Called by the owner when its count drops to zero, and for
+// objects taken off its queue.
+static void merge(RefcountHeader* header, bool dequeued)
+{
+    long long biased = header->count*SHARED_ONE;
+    header->count = 0;
+    long long shared = __atomic_load_n(&header->shared, __ATOMIC_RELAXED);
+    long long merged;
+    do {
+        merged = shared;
+        if (!(shared & SHARED_MERGED)) merged += biased+SHARED_MERGED;
+        if (dequeued) merged &= ~SHARED_QUEUED;
+    } while (!__atomic_compare_exchange_n(&header->shared, &shared, merged, true,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    // Only once merged, so that a thread queueing the object first still
+    // finds its owner.
+    __atomic_store_n(&header->owner, 0, __ATOMIC_RELEASE);
+    if (!(merged & SHARED_QUEUED) && shared_count(merged)==0) rc_release(header);
+}
+
+static void thread_exit(void* state);
+
+static void create_thread_key(void)
+{
+    pthread_key_create(&thread_key, thread_exit);
+}
+
+static unsigned current_thread(void)
+{
+    if (self_id!=NO_THREAD) return self_id;
+    pthread_once(&thread_key_once, create_thread_key);
+    ThreadState* state = calloc(1, sizeof(ThreadState));
+    if (!state) {
+        printf("Failed to register a reference counting thread.\n");
+        exit(1);
+    }
+    pthread_mutex_init(&state->lock, NULL);
+
+    pthread_mutex_lock(&registry_lock);
+    ThreadState** grown = realloc(thread_states, (thread_count+1)*sizeof(ThreadState*));
+    if (!grown) {
+        printf("Failed to register a reference counting thread.\n");
+        exit(1);
+    }
+    thread_states = grown;
+    thread_states[thread_count++] = state;
+    self_id = (unsigned) thread_count;
+    pthread_mutex_unlock(&registry_lock);
+
+    self = state;
+    pthread_setspecific(thread_key, state);
+    return self_id;
+}
+
+static void queue_for_owner(unsigned owner, RefcountHeader* header)
+{
+    pthread_mutex_lock(&registry_lock);
+    ThreadState* state = thread_states[owner-1];
+    pthread_mutex_unlock(&registry_lock);
+
+    pthread_mutex_lock(&state->lock);
+    bool exited = state->exited;
+    if (!exited) {
+        push_header(&state->queue, header);
+        __atomic_store_n(&state->queued, state->queue.count, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&state->lock);
+    if (exited) merge(header, true);
+}
+
+static void merge_queue(void)
+{
+    if (!self || __atomic_load_n(&self->queued, __ATOMIC_ACQUIRE)==0) return;
+    pthread_mutex_lock(&self->lock);
+    HeaderStack queue = self->queue;
+    self->queue = (HeaderStack) {0};
+    __atomic_store_n(&self->queued, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&self->lock);
+
+    for (size_t i = 0; i<queue.count; i++) {
+        merge(queue.items[i], true);
+    }
+    free_stack(&queue);
+}
+
+static void thread_exit(void* state)
+{
+    ThreadState* exiting = state;
+    pthread_mutex_lock(&exiting->lock);
+    exiting->exited = true;
+    pthread_mutex_unlock(&exiting->lock);
+    merge_queue();
+    drain_pending(0);
+    free_stack(&pending);
+    fold_thread_ops();
+    orphan_cells();
+}
+
+static void inc_biased(RefcountHeader* header)
+{
+    if (__atomic_load_n(&header->owner, __ATOMIC_RELAXED)==self_id) {
+        header->count++;
+        return;
+    }
+    // Registered so that its operations are counted when it exits.
+    current_thread();
+    thread_ops.shared_updates++;
+    __atomic_add_fetch(&header->shared, SHARED_ONE, __ATOMIC_RELAXED);
+}
+
+static void dec_biased(RefcountHeader* header)
+{
+    unsigned owner = __atomic_load_n(&header->owner, __ATOMIC_ACQUIRE);
+    if (owner==self_id) {
+        if (--header->count==0) merge(header, false);
+        return;
+    }
+    current_thread();
+    thread_ops.shared_updates++;
+    long long shared = __atomic_load_n(&header->shared, __ATOMIC_RELAXED);
+    long long dropped;
+    do {
+        dropped = shared-SHARED_ONE;
+        if (!(shared & (SHARED_MERGED|SHARED_QUEUED)) && shared_count(dropped)<0) {
+            dropped |= SHARED_QUEUED;
+        }
+    } while (!__atomic_compare_exchange_n(&header->shared, &shared, dropped, true,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    if ((dropped & SHARED_QUEUED) && !(shared & SHARED_QUEUED)) {
+        queue_for_owner(owner, header);
+    }
+    else if ((dropped & (SHARED_MERGED|SHARED_QUEUED))==SHARED_MERGED && shared_count(dropped)==0) {
+        rc_release(header);
+    }
+}
+
+// Any other threads must have exited by now.
+static void free_thread_states(void)
+{
+    if (self) pthread_setspecific(thread_key, NULL);
+    pthread_mutex_lock(&registry_lock);
+    for (size_t i = 0; i<thread_count; i++) {
+        pthread_mutex_destroy(&thread_states[i]->lock);
+        free_stack(&thread_states[i]->queue);
+        free(thread_states[i]);
+    }
+    free(thread_states);
+    thread_states = NULL;
+    thread_count = 0;
+    pthread_mutex_unlock(&registry_lock);
+    self = NULL;
+    self_id = NO_THREAD;
+}
+#endif
+
+static void* rc_alloc_typed(size_t bytes, TypeDescriptor* type)
+{
+    merge_queue();
+    if (pending.count>0) drain_pending(free_budget);
+    if (deferred && zct.count>=next_reconcile) reconcile(GC_TRIGGER_THRESHOLD, true);
+
+    size_t size;
+    // Zeroed so a release never drops a field that was never stored.
+    RefcountHeader* header = new_header(bytes, &size);
+    if (!header) return NULL;
+
+    // A deferred count leaves out the local the object is about to go in.
+    header->count = deferred ? 0 : 1;
+#ifdef RC_COMPACT_HEADER
+    header->tag = type_tag(type);
+#else
+    header->size = size;
+    header->type = type;
+    header->owner = rc_thread_safe ? current_thread() : 0;
+#endif
+    header->color = live_color(header);
+    if (deferred) defer(header);
+    count_allocation(size);
+    return header+1;
+}
+
+static void* rc_alloc(size_t bytes)
+{
+    return rc_alloc_typed(bytes, NULL);
 }
 
 static void inc_ref_count(void* ptr, void* other)
 {
+    (void) other;
+#ifndef RC_COMPACT_HEADER
+    if (rc_thread_safe) {
+        thread_ops.increments++;
+        if (ptr) inc_biased((RefcountHeader*) ptr-1);
+        return;
+    }
+#endif
+    rc_stats.total_increments++;
     if (!ptr) return;
     RefcountHeader* header = (RefcountHeader*) ((char*) ptr-sizeof(RefcountHeader));
     header->count++;
-    if (other) {
-        RefcountHeader* otherHeader = (RefcountHeader*) ((char*) other-sizeof(RefcountHeader));
-        if (otherHeader->idx<3)
-            otherHeader->to_free[otherHeader->idx++] = ptr;
-    }
 #ifdef DEBUG
-    printf("(debug) inc %lld\n", header->count);
+    printf("(debug) inc %lld\n", (long long) header->count);
 #endif
 }
 
 static void dec_ref_count(void* ptr, size_t offset)
 {
+#ifndef RC_COMPACT_HEADER
+    if (rc_thread_safe) {
+        thread_ops.decrements++;
+        if (ptr) dec_biased((RefcountHeader*) ((char*) ptr-offset)-1);
+        return;
+    }
+#endif
+    rc_stats.total_decrements++;
     if (!ptr) return;
     RefcountHeader* header = (RefcountHeader*) ((char*) ptr-offset-sizeof(RefcountHeader));
     header->count--;
 #ifdef DEBUG
-    printf("(debug) dec %lld\n", header->count);
+    printf("(debug) dec %lld\n", (long long) header->count);
 #endif
     if (header->count==0) {
-        for (int i = 0; i<header->idx; i++) {
-            dec_ref_count(header->to_free[i], 0);
-        }
-        stats.total_collections++;
-        stats.current_bytes -= header->size;
-        free(header);
+        rc_release(header);
+    }
+    else {
+        rc_possible_root(header);
     }
 }
 
@@ -75,26 +1057,105 @@ static void rc_dealloc(void* ptr)
 {
 }
 
+// Other threads may be changing counts, so cycles are only looked for when
+// a single thread uses the heap.
 static void rc_gc(void)
 {
+    merge_queue();
+    drain_pending(0);
+    if (deferred) reconcile(GC_TRIGGER_EXPLICIT, true);
+    else if (!rc_thread_safe) collect_cycles(GC_TRIGGER_EXPLICIT);
 }
 
 static void rc_scope_end(void)
 {
+    merge_queue();
+    if (pending.count>0) drain_pending(free_budget);
 }
 
 static AllocatorStats* rc_get_stats(void)
 {
-    return &stats;
+    if (rc_thread_safe) fold_thread_ops();
+    return &rc_stats;
+}
+
+// Must be chosen before the first allocation.
+static void rc_set_gc_mode(unsigned modes)
+{
+#ifndef RC_COMPACT_HEADER
+    rc_thread_safe = (modes & GC_MODE_THREAD_SAFE)!=0;
+#endif
+    deferred = (modes & GC_MODE_DEFERRED)!=0 && !rc_thread_safe;
+}
+
+static void rc_register_root(void* ptr)
+{
+    if (root_entry_count==root_entry_capacity) {
+        root_entries = grow_array(root_entries, &root_entry_capacity, sizeof(RootEntry));
+    }
+    root_entries[root_entry_count++] = (RootEntry) {ptr, 1, NULL};
+}
+
+static void rc_register_roots(const RootEntry* entries, size_t count)
+{
+    if (root_table_count==root_table_capacity) {
+        root_tables = grow_array(root_tables, &root_table_capacity, sizeof(RootTable));
+    }
+    root_tables[root_table_count++] = (RootTable) {entries, count};
+}
+
+static void rc_set_free_budget(size_t objects)
+{
+    free_budget = objects;
+}
+
+static void rc_set_cycle_buffer(size_t objects)
+{
+    cycle_buffer = objects ? objects : 1;
+}
+
+static void rc_set_stack_bottom(void* bottom)
+{
+    stack_bottom = bottom;
 }
 
 static void rc_init(void)
 {
-    memset(&stats, 0, sizeof(stats));
+    next_reconcile = zct_limit;
+    memset(&rc_stats, 0, sizeof(rc_stats));
+    thread_ops = (ThreadOps) {0};
+    pthread_once(&pool_once, init_classes);
+    const char* budget = getenv("JBLANG_GC_FREE_BUDGET");
+    free_budget = budget ? strtoul(budget, NULL, 10) : 0;
 }
 
 static void rc_shutdown(void)
 {
+    merge_queue();
+    if (deferred) reconcile(GC_TRIGGER_SHUTDOWN, false);
+    drain_pending(0);
+    if (roots.count>0) collect_cycles(GC_TRIGGER_SHUTDOWN);
+    if (rc_thread_safe) fold_thread_ops();
+    free_thread_states();
+    free_chunks();
+#ifdef RC_COMPACT_HEADER
+    clear_type_table();
+#endif
+    free_stack(&pending);
+    free_stack(&roots);
+    free_stack(&work);
+    free_stack(&blacken);
+    free_stack(&garbage);
+    free_stack(&zct);
+    free(held_words);
+    free(root_entries);
+    free(root_tables);
+    held_words = NULL;
+    root_entries = NULL;
+    root_tables = NULL;
+    held_count = held_capacity = 0;
+    root_entry_count = root_entry_capacity = 0;
+    root_table_count = root_table_capacity = 0;
 }
 
 static const RuntimeAllocator reference_count_allocator = {
@@ -102,10 +1163,17 @@ static const RuntimeAllocator reference_count_allocator = {
         .inc_ref_count = inc_ref_count,
         .dec_ref_count = dec_ref_count,
         .alloc = rc_alloc,
+        .alloc_typed = rc_alloc_typed,
         .dealloc  = rc_dealloc,
         .gc = rc_gc,
         .scope_end = rc_scope_end,
         .get_stats = rc_get_stats,
+        .set_free_budget = rc_set_free_budget,
+        .set_cycle_buffer = rc_set_cycle_buffer,
+        .set_stack_bottom = rc_set_stack_bottom,
+        .set_gc_mode = rc_set_gc_mode,
+        .register_root = rc_register_root,
+        .register_roots = rc_register_roots,
         .init = rc_init,
         .shutdown = rc_shutdown
 };
@@ -1,10 +1,14 @@
 #include "runtime.h"
 #include "allocator_interface.h"
+#include "gc_telemetry.h"
 #include <stdio.h>
 #include <stddef.h>
+#include <string.h>
 
 static const RuntimeAllocator* current_allocator = NULL;
 
+TypeDescriptor runtime_pointer_free = {0, NULL, 0, NULL};
+
 void runtime_init(void)
 {
     current_allocator = get_allocator_implementation();
@@ -22,6 +26,8 @@ void runtime_shutdown(void)
         current_allocator->shutdown();
 #ifdef DEBUG
         runtime_print_stats();
+#else
+        if (getenv("JBLANG_GC_STATS")) runtime_print_stats();
 #endif
         current_allocator = NULL;
     }
@@ -32,6 +38,14 @@ void* runtime_alloc(size_t bytes)
     return current_allocator ? current_allocator->alloc(bytes) : NULL;
 }
 
+void* runtime_alloc_typed(size_t bytes, TypeDescriptor* type)
+{
+    if (current_allocator && current_allocator->alloc_typed) {
+        return current_allocator->alloc_typed(bytes, type);
+    }
+    return runtime_alloc(bytes);
+}
+
 void runtime_scope_end()
 {
     if (current_allocator && current_allocator->scope_end) {
@@ -55,12 +69,73 @@ void runtime_set_gc_threshold(size_t threshold) {
     }
 }
 
+void runtime_set_gc_pacer(unsigned growth_percent, size_t min_bytes, size_t max_bytes) {
+    if (current_allocator && current_allocator->set_gc_pacer) {
+        current_allocator->set_gc_pacer(growth_percent, min_bytes, max_bytes);
+    }
+}
+
 void runtime_register_root(void* ptr) {
     if (current_allocator && current_allocator->register_root) {
         current_allocator->register_root(ptr);
     }
 }
 
+void runtime_register_roots(const RootEntry* roots, size_t count) {
+    if (current_allocator && current_allocator->register_roots) {
+        current_allocator->register_roots(roots, count);
+    }
+}
+
+void runtime_set_gc_mode(unsigned modes) {
+    if (current_allocator && current_allocator->set_gc_mode) {
+        current_allocator->set_gc_mode(modes);
+    }
+}
+
+void runtime_set_gc_step_budget(size_t words) {
+    if (current_allocator && current_allocator->set_gc_step_budget) {
+        current_allocator->set_gc_step_budget(words);
+    }
+}
+
+void runtime_set_free_budget(size_t objects) {
+    if (current_allocator && current_allocator->set_free_budget) {
+        current_allocator->set_free_budget(objects);
+    }
+}
+
+void runtime_set_cycle_buffer(size_t objects) {
+    if (current_allocator && current_allocator->set_cycle_buffer) {
+        current_allocator->set_cycle_buffer(objects);
+    }
+}
+
+void runtime_set_stack_bottom(void* bottom) {
+    if (current_allocator && current_allocator->set_stack_bottom) {
+        current_allocator->set_stack_bottom(bottom);
+    }
+}
+
+void runtime_set_nursery_size(size_t bytes) {
+    if (current_allocator && current_allocator->set_nursery_size) {
+        current_allocator->set_nursery_size(bytes);
+    }
+}
+
+void runtime_set_gc_threads(unsigned threads) {
+    if (current_allocator && current_allocator->set_gc_threads) {
+        current_allocator->set_gc_threads(threads);
+    }
+}
+
+void runtime_write_barrier(void* field, void* value)
+{
+    if (current_allocator && current_allocator->write_barrier) {
+        current_allocator->write_barrier(field, value);
+    }
+}
+
 const char* runtime_get_allocator_name(void)
 {
     return current_allocator->name;
@@ -74,19 +149,35 @@ AllocatorStats* runtime_get_stats(void)
 void runtime_print_stats(void)
 {
     AllocatorStats* stats = runtime_get_stats();
+    const char* format = getenv("JBLANG_GC_STATS");
+    if (format && strcmp(format, "json")==0) {
+        telemetry_print_json(stats, runtime_get_allocator_name(), stderr);
+        return;
+    }
     printf("\n\nRuntime Stats (%s)\n", runtime_get_allocator_name());
     printf("Total allocs: %zu\nTotal collections: %zu\n", stats->total_allocations, stats->total_collections);
+    printf("Objects freed: %zu\n", stats->total_objects_freed);
+    if (stats->total_increments || stats->total_decrements) {
+        printf("Ref count ops: %zu inc, %zu dec\n", stats->total_increments, stats->total_decrements);
+    }
+    if (stats->shared_updates) {
+        printf("Shared ref count ops: %zu\n", stats->shared_updates);
+    }
+    if (stats->cycle_objects_freed) {
+        printf("Freed in cycles: %zu\n", stats->cycle_objects_freed);
+    }
     printf("Current bytes: %zu\nPeak bytes: %zu\n", stats->current_bytes, stats->peak_bytes);
 }
 
-void runtime_inc_ref_count(void* ptr, void* other)
+// Parenthesized so that the inlined versions' macros leave them alone.
+void (runtime_inc_ref_count)(void* ptr, void* other)
 {
     if (current_allocator->inc_ref_count) {
         current_allocator->inc_ref_count(ptr, other);
     }
 }
 
-void runtime_dec_ref_count(void* ptr, size_t offset)
+void (runtime_dec_ref_count)(void* ptr, size_t offset)
 {
     if (current_allocator->dec_ref_count) {
         current_allocator->dec_ref_count(ptr, offset);
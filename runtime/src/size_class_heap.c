@@ -0,0 +1,462 @@
+#define _POSIX_C_SOURCE 200112L
+#include "size_class_heap.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+// Pages are carved out of larger chunks so that posix_memalign is not called
+// once per page. Chunks are only returned to the system at shutdown; empty
+// pages go back to a pool shared by all classes.
+#define CHUNK_PAGES 64
+#define CHUNK_SIZE (CHUNK_PAGES*PAGE_SIZE)
+#define CLASS_GRANULE 16
+
+static const size_t class_sizes[] = {
+        16, 32, 48, 64, 80, 96, 112, 128,
+        160, 192, 224, 256, 320, 384, 448, 512,
+        640, 768, 1024
+};
+#define NUM_CLASSES (sizeof(class_sizes)/sizeof(class_sizes[0]))
+
+typedef struct FreeCell {
+  struct FreeCell* next;
+} FreeCell;
+
+typedef struct SizeClass {
+  size_t cell_size;
+  size_t cell_count;
+  uint32_t cell_reciprocal;
+  PageInfo* current;
+  FreeCell* free_list;
+  char* bump;
+  char* bump_limit;
+  PageInfo* available;
+  PageInfo* unswept;
+  PageInfo* pages;
+} SizeClass;
+
+typedef struct Chunk {
+  void* memory;
+  struct Chunk* next;
+} Chunk;
+
+static SizeClass classes[NUM_CLASSES];
+static unsigned char class_for_granules[SC_MAX_SIZE/CLASS_GRANULE+1];
+static Chunk* chunks = NULL;
+static void* page_pool = NULL;
+static bool initialised = false;
+
+// Pending pages may be swept from a background thread, so everything outside
+// the allocation fast path, which only touches the current page, takes this.
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void sc_init(void)
+{
+    if (initialised) return;
+
+    unsigned c = 0;
+    for (size_t g = 0; g<=SC_MAX_SIZE/CLASS_GRANULE; g++) {
+        while (class_sizes[c]<g*CLASS_GRANULE) c++;
+        class_for_granules[g] = (unsigned char) c;
+    }
+    for (size_t i = 0; i<NUM_CLASSES; i++) {
+        SizeClass* sc = &classes[i];
+        sc->cell_size = class_sizes[i];
+        sc->cell_count = PAGE_SIZE/class_sizes[i];
+        sc->cell_reciprocal = (uint32_t) ((((uint64_t) 1<<32)+class_sizes[i]-1)/class_sizes[i]);
+    }
+    initialised = true;
+}
+
+static void* take_page(void)
+{
+    if (!page_pool) {
+        void* memory = NULL;
+        Chunk* chunk = malloc(sizeof(Chunk));
+        if (!chunk || posix_memalign(&memory, PAGE_SIZE, CHUNK_SIZE)!=0) {
+            printf("Failed to allocate heap chunk.");
+            exit(1);
+        }
+        chunk->memory = memory;
+        chunk->next = chunks;
+        chunks = chunk;
+
+        for (size_t i = CHUNK_PAGES; i>0; i--) {
+            void* page = (char*) memory+(i-1)*PAGE_SIZE;
+            *(void**) page = page_pool;
+            page_pool = page;
+        }
+    }
+    void* page = page_pool;
+    page_pool = *(void**) page;
+    return page;
+}
+
+static PageInfo* new_page(unsigned class_index)
+{
+    SizeClass* sc = &classes[class_index];
+    PageInfo* page = page_map_add_page(take_page());
+    page->size_class = class_index;
+    page->cell_size = sc->cell_size;
+    page->cell_count = sc->cell_count;
+    page->cell_reciprocal = sc->cell_reciprocal;
+    page->next = sc->pages;
+    page->prev = NULL;
+    if (sc->pages) sc->pages->prev = page;
+    sc->pages = page;
+    return page;
+}
+
+static void release_page(SizeClass* sc, PageInfo* page)
+{
+    if (page->prev) page->prev->next = page->next;
+    else sc->pages = page->next;
+    if (page->next) page->next->prev = page->prev;
+    if (sc->current==page) {
+        sc->current = NULL;
+        sc->free_list = NULL;
+        sc->bump = sc->bump_limit = NULL;
+    }
+    void* memory = page->base;
+    page_map_remove_page(memory);
+    *(void**) memory = page_pool;
+    page_pool = memory;
+}
+
+// Makes page the class's current page by threading its free cells into a
+// list, so the allocation fast path is a pop.
+static void use_page(SizeClass* sc, PageInfo* page)
+{
+    FreeCell* head = NULL;
+    for (size_t i = page->cell_count; i>0; i--) {
+        if (page_bit(page->alloc_bits, i-1)) continue;
+        FreeCell* cell = page_cell(page, i-1);
+        cell->next = head;
+        head = cell;
+    }
+    sc->current = page;
+    sc->free_list = head;
+    sc->bump = sc->bump_limit = NULL;
+}
+
+// A fresh page has no free cells to thread; they are handed out in address
+// order by bumping a pointer instead.
+static void use_fresh_page(SizeClass* sc, PageInfo* page)
+{
+    sc->current = page;
+    sc->free_list = NULL;
+    sc->bump = page->base;
+    sc->bump_limit = page->base+page->cell_count*page->cell_size;
+}
+
+// Frees the unmarked cells of one page. An empty page goes back to the pool
+// and a partly free one onto its class's available list.
+static size_t sweep_page(SizeClass* sc, PageInfo* page, size_t* freed_objects)
+{
+    size_t live = 0;
+    for (size_t w = 0; w<PAGE_CELL_WORDS; w++) {
+        uint64_t dead = page->alloc_bits[w] & ~page->mark_bits[w];
+        *freed_objects += __builtin_popcountll(dead);
+        page->alloc_bits[w] &= page->mark_bits[w];
+        live += __builtin_popcountll(page->alloc_bits[w]);
+    }
+    size_t freed_bytes = (page->objects-live)*sc->cell_size;
+    page->objects = live;
+    page->unswept = false;
+
+    if (live==0) {
+        release_page(sc, page);
+    }
+    else if (live<page->cell_count) {
+        page->next_available = sc->available;
+        sc->available = page;
+    }
+    return freed_bytes;
+}
+
+// Sweeps this class's pending pages until one of them has a free cell.
+static bool sweep_until_available(SizeClass* sc)
+{
+    size_t freed_objects = 0;
+    while (!sc->available && sc->unswept) {
+        PageInfo* page = sc->unswept;
+        sc->unswept = page->next_available;
+        sweep_page(sc, page, &freed_objects);
+    }
+    return sc->available!=NULL;
+}
+
+void* sc_alloc(size_t size, uint16_t tag, size_t* cell_size)
+{
+    if (size>SC_MAX_SIZE) return NULL;
+    if (size==0) size = 1;
+
+    unsigned class_index = class_for_granules[(size+CLASS_GRANULE-1)/CLASS_GRANULE];
+    SizeClass* sc = &classes[class_index];
+
+    void* cell;
+    if (sc->free_list) {
+        cell = sc->free_list;
+        sc->free_list = sc->free_list->next;
+    }
+    else if (sc->bump<sc->bump_limit) {
+        cell = sc->bump;
+        sc->bump += sc->cell_size;
+    }
+    else {
+        pthread_mutex_lock(&heap_lock);
+        if (sc->available || sweep_until_available(sc)) {
+            PageInfo* page = sc->available;
+            sc->available = page->next_available;
+            use_page(sc, page);
+            cell = sc->free_list;
+            sc->free_list = sc->free_list->next;
+        }
+        else {
+            use_fresh_page(sc, new_page(class_index));
+            cell = sc->bump;
+            sc->bump += sc->cell_size;
+        }
+        pthread_mutex_unlock(&heap_lock);
+    }
+
+    PageInfo* page = sc->current;
+    size_t index = page_cell_index(page, cell);
+    page_set_bit(page->alloc_bits, index);
+    page->cell_tags[index] = tag;
+    page->objects++;
+
+    memset(cell, 0, sc->cell_size);
+    *cell_size = sc->cell_size;
+    return cell;
+}
+
+void sc_free(PageInfo* page, size_t index)
+{
+    SizeClass* sc = &classes[page->size_class];
+    pthread_mutex_lock(&heap_lock);
+    page_clear_bit(page->alloc_bits, index);
+    page_clear_bit(page->mark_bits, index);
+    page->objects--;
+
+    // Sweeping decides which list an unswept page belongs on.
+    if (!page->unswept) {
+        if (page==sc->current) {
+            FreeCell* cell = page_cell(page, index);
+            cell->next = sc->free_list;
+            sc->free_list = cell;
+        }
+        else if (page->objects+1==page->cell_count) {
+            // Was full, so it is on neither the current slot nor the available list.
+            page->next_available = sc->available;
+            sc->available = page;
+        }
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+void sc_clear_marks(void)
+{
+    for (size_t i = 0; i<NUM_CLASSES; i++) {
+        for (PageInfo* page = classes[i].pages; page; page = page->next) {
+            memset(page->mark_bits, 0, sizeof(page->mark_bits));
+        }
+    }
+}
+
+static void reset_class(SizeClass* sc)
+{
+    sc->available = NULL;
+    sc->unswept = NULL;
+    sc->current = NULL;
+    sc->free_list = NULL;
+    sc->bump = sc->bump_limit = NULL;
+}
+
+size_t sc_sweep(size_t* freed_objects)
+{
+    size_t freed_bytes = 0;
+    *freed_objects = 0;
+
+    pthread_mutex_lock(&heap_lock);
+    for (size_t i = 0; i<NUM_CLASSES; i++) {
+        SizeClass* sc = &classes[i];
+        reset_class(sc);
+        for (PageInfo* page = sc->pages; page;) {
+            PageInfo* next = page->next;
+            freed_bytes += sweep_page(sc, page, freed_objects);
+            page = next;
+        }
+    }
+    pthread_mutex_unlock(&heap_lock);
+    return freed_bytes;
+}
+
+void sc_begin_lazy_sweep(void)
+{
+    pthread_mutex_lock(&heap_lock);
+    for (size_t i = 0; i<NUM_CLASSES; i++) {
+        SizeClass* sc = &classes[i];
+        reset_class(sc);
+        for (PageInfo* page = sc->pages; page; page = page->next) {
+            page->unswept = true;
+            page->next_available = sc->unswept;
+            sc->unswept = page;
+        }
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+size_t sc_finish_sweep(size_t* freed_objects)
+{
+    size_t freed_bytes = 0;
+    *freed_objects = 0;
+
+    pthread_mutex_lock(&heap_lock);
+    for (size_t i = 0; i<NUM_CLASSES; i++) {
+        SizeClass* sc = &classes[i];
+        while (sc->unswept) {
+            PageInfo* page = sc->unswept;
+            sc->unswept = page->next_available;
+            freed_bytes += sweep_page(sc, page, freed_objects);
+        }
+    }
+    pthread_mutex_unlock(&heap_lock);
+    return freed_bytes;
+}
+
+// The lock is dropped between pages so allocation never waits for more than
+// one page to be swept.
+bool sc_sweep_step(void)
+{
+    size_t freed_objects = 0;
+    bool swept = false;
+    pthread_mutex_lock(&heap_lock);
+    for (size_t i = 0; i<NUM_CLASSES && !swept; i++) {
+        SizeClass* sc = &classes[i];
+        if (!sc->unswept) continue;
+        PageInfo* page = sc->unswept;
+        sc->unswept = page->next_available;
+        sweep_page(sc, page, &freed_objects);
+        swept = true;
+    }
+    pthread_mutex_unlock(&heap_lock);
+    return swept;
+}
+
+bool sc_sweep_pending(void)
+{
+    bool pending = false;
+    pthread_mutex_lock(&heap_lock);
+    for (size_t i = 0; i<NUM_CLASSES && !pending; i++) {
+        pending = classes[i].unswept!=NULL;
+    }
+    pthread_mutex_unlock(&heap_lock);
+    return pending;
+}
+
+static bool worth_evacuating(const PageInfo* page)
+{
+    return !page->pinned && page->objects*2<=page->cell_count;
+}
+
+size_t sc_begin_evacuation(void)
+{
+    size_t flagged = 0;
+    pthread_mutex_lock(&heap_lock);
+    for (size_t i = 0; i<NUM_CLASSES; i++) {
+        SizeClass* sc = &classes[i];
+        size_t candidates = 0;
+        for (PageInfo* page = sc->pages; page; page = page->next) {
+            if (worth_evacuating(page)) candidates++;
+        }
+        if (candidates<2) continue;
+
+        // Rebuild the class's free space from the pages that stay.
+        reset_class(sc);
+        for (PageInfo* page = sc->pages; page; page = page->next) {
+            if (worth_evacuating(page)) {
+                page->evacuating = true;
+                flagged++;
+            }
+            else if (page->objects<page->cell_count) {
+                page->next_available = sc->available;
+                sc->available = page;
+            }
+        }
+    }
+    pthread_mutex_unlock(&heap_lock);
+    return flagged;
+}
+
+void sc_for_each_evacuating(void (* fn)(PageInfo* page, size_t index))
+{
+    for (size_t i = 0; i<NUM_CLASSES; i++) {
+        for (PageInfo* page = classes[i].pages; page; page = page->next) {
+            if (!page->evacuating) continue;
+            for (size_t c = 0; c<page->cell_count; c++) {
+                if (page_bit(page->alloc_bits, c)) fn(page, c);
+            }
+        }
+    }
+}
+
+void sc_finish_evacuation(void)
+{
+    pthread_mutex_lock(&heap_lock);
+    for (size_t i = 0; i<NUM_CLASSES; i++) {
+        SizeClass* sc = &classes[i];
+        for (PageInfo* page = sc->pages; page;) {
+            PageInfo* next = page->next;
+            if (page->evacuating) release_page(sc, page);
+            else page->pinned = false;
+            page = next;
+        }
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+void sc_for_each_object(void (* fn)(void* object, size_t size))
+{
+    for (size_t i = 0; i<NUM_CLASSES; i++) {
+        for (PageInfo* page = classes[i].pages; page; page = page->next) {
+            for (size_t c = 0; c<page->cell_count; c++) {
+                if (page_bit(page->alloc_bits, c)) fn(page_cell(page, c), page->cell_size);
+            }
+        }
+    }
+}
+
+void sc_for_each_marked(void (* fn)(void* object, size_t size))
+{
+    for (size_t i = 0; i<NUM_CLASSES; i++) {
+        for (PageInfo* page = classes[i].pages; page; page = page->next) {
+            for (size_t c = 0; c<page->cell_count; c++) {
+                if (page_bit(page->mark_bits, c)) fn(page_cell(page, c), page->cell_size);
+            }
+        }
+    }
+}
+
+void sc_shutdown(void)
+{
+    for (size_t i = 0; i<NUM_CLASSES; i++) {
+        SizeClass* sc = &classes[i];
+        for (PageInfo* page = sc->pages; page;) {
+            PageInfo* next = page->next;
+            page_map_remove_page(page->base);
+            page = next;
+        }
+        sc->pages = NULL;
+        reset_class(sc);
+    }
+    while (chunks) {
+        Chunk* next = chunks->next;
+        free(chunks->memory);
+        free(chunks);
+        chunks = next;
+    }
+    page_pool = NULL;
+}
@@ -0,0 +1,80 @@
+#undef NDEBUG
+#include "mark_sweep_allocator.h"
+#include "test_helpers.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdint.h>
+
+// Integers on the stack that look like heap addresses. One points into a
+// dead object and keeps it alive, which shows up as false retention; one
+// points where a freed array used to be, and the next array of that size must
+// not be placed under it.
+
+#define ARRAY_BYTES (256*1024)
+
+static long* held = NULL;
+
+static uintptr_t __attribute__((noinline)) allocate_and_free(const RuntimeAllocator* gc)
+{
+    long* array = gc->alloc_typed(ARRAY_BYTES, &runtime_pointer_free);
+    uintptr_t inside = (uintptr_t) array+ARRAY_BYTES/2;
+    gc->dealloc(array);
+    return inside;
+}
+
+static uintptr_t __attribute__((noinline)) allocate_unreferenced(const RuntimeAllocator* gc)
+{
+    long* array = gc->alloc(ARRAY_BYTES);
+    return (uintptr_t) array+100;
+}
+
+static void __attribute__((noinline)) allocate_held(const RuntimeAllocator* gc)
+{
+    held = gc->alloc_typed(ARRAY_BYTES, &runtime_pointer_free);
+}
+
+static bool __attribute__((noinline)) held_covers(uintptr_t address)
+{
+    return address>=(uintptr_t) held && address<(uintptr_t) held+ARRAY_BYTES;
+}
+
+int main(void)
+{
+    const RuntimeAllocator* gc = get_mark_sweep_allocator();
+    gc->register_root(&held);
+    gc->init();
+    gc->set_gc_threshold(SIZE_MAX);
+    AllocatorStats* stats = gc->get_stats();
+
+    volatile uintptr_t retaining = allocate_unreferenced(gc);
+    clear_stack();
+    gc->gc();
+    assert(stats->current_bytes>=ARRAY_BYTES);
+    assert(stats->false_retained_objects==1);
+    assert(stats->false_retained_bytes>=ARRAY_BYTES);
+
+    retaining = 0;
+    clear_stack();
+    gc->gc();
+    assert(stats->current_bytes==0);
+    assert(stats->false_retained_objects==0);
+
+    volatile uintptr_t stale = allocate_and_free(gc);
+    clear_stack();
+    gc->gc();
+    assert(stats->blacklisted_pages>0);
+
+    allocate_held(gc);
+    assert(!held_covers(stale));
+    assert(stats->blacklisted_mappings>0);
+
+    held = NULL;
+    clear_stack();
+    gc->gc();
+    assert(stats->current_bytes==0);
+
+    (void) retaining;
+    gc->shutdown();
+    printf("blacklist test passed\n");
+    return 0;
+}
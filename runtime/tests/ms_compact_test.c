@@ -0,0 +1,120 @@
+#undef NDEBUG
+#include "mark_sweep_allocator.h"
+#include "test_helpers.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+
+// Leaves a typed list spread thinly over many pages, then checks that a
+// compacting collection packs it into far fewer, keeps it intact, and leaves
+// alone objects that are referenced from the stack or from untyped memory.
+
+#define LIST_LENGTH 20000
+#define GARBAGE_PER_NODE 7
+#define PAGE_BYTES 4096
+
+typedef struct Node {
+  struct Node* next;
+  long value;
+  long padding[2];
+} Node;
+
+static const size_t node_pointers[] = {offsetof(Node, next)};
+static TypeDescriptor node_type = {1, node_pointers, 0};
+
+static Node* head = NULL;
+static void** untyped = NULL;
+
+static void __attribute__((noinline)) build(const RuntimeAllocator* gc)
+{
+    Node* tail = NULL;
+    for (long i = 0; i<LIST_LENGTH; i++) {
+        for (int j = 0; j<GARBAGE_PER_NODE; j++) {
+            gc->alloc_typed(sizeof(Node), &node_type);
+        }
+        Node* node = gc->alloc_typed(sizeof(Node), &node_type);
+        node->value = i;
+        if (tail) tail->next = node;
+        else head = node;
+        tail = node;
+    }
+    untyped = gc->alloc(2*sizeof(void*));
+}
+
+static Node* __attribute__((noinline)) find(long value)
+{
+    for (Node* node = head; node; node = node->next) {
+        if (node->value==value) return node;
+    }
+    return NULL;
+}
+
+static void __attribute__((noinline)) pin_target(void)
+{
+    untyped[0] = find(LIST_LENGTH/2);
+}
+
+// Distinct pages the list runs through. Consecutive nodes mostly share one,
+// so counting page changes is close enough.
+static size_t __attribute__((noinline)) list_pages(void)
+{
+    size_t pages = 0;
+    uintptr_t last = 0;
+    long expected = 0;
+    for (Node* node = head; node; node = node->next, expected++) {
+        assert(node->value==expected);
+        uintptr_t page = (uintptr_t) node/PAGE_BYTES;
+        if (page!=last) pages++;
+        last = page;
+    }
+    assert(expected==LIST_LENGTH);
+    return pages;
+}
+
+// Pinned by the stack and by the untyped buffer respectively. Kept out of
+// main so the lookups leave nothing in its frame.
+static void __attribute__((noinline)) check_pinned(Node* anchor)
+{
+    assert(find(LIST_LENGTH/4)==anchor);
+    assert(find(LIST_LENGTH/2)==untyped[0]);
+}
+
+int main(void)
+{
+    const RuntimeAllocator* gc = get_mark_sweep_allocator();
+    gc->register_root(&head);
+    gc->register_root(&untyped);
+    gc->init();
+    gc->set_gc_threshold(SIZE_MAX);
+
+    build(gc);
+    Node* volatile anchor = find(LIST_LENGTH/4);
+    pin_target();
+    clear_stack();
+    gc->gc();
+
+    size_t live_bytes = gc->get_stats()->current_bytes;
+    size_t pages_before = list_pages();
+    gc->set_gc_mode(GC_MODE_COMPACT);
+    clear_stack();
+    gc->gc();
+    size_t pages_after = list_pages();
+
+    assert(gc->get_stats()->current_bytes==live_bytes);
+    assert(gc->get_stats()->compacted_bytes>0);
+    assert(pages_after*4<pages_before);
+
+    check_pinned(anchor);
+
+    anchor = NULL;
+    head = NULL;
+    untyped = NULL;
+    clear_stack();
+    gc->gc();
+    assert(gc->get_stats()->current_bytes==0);
+
+    gc->shutdown();
+    printf("compaction test passed\n");
+    return 0;
+}
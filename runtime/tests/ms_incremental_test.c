@@ -0,0 +1,84 @@
+#undef NDEBUG
+#include "mark_sweep_allocator.h"
+#include "test_helpers.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdint.h>
+
+// Keeps reshuffling a live list through the write barrier while incremental
+// cycles run underneath, then checks that nothing reachable was freed.
+
+#define LIST_LENGTH 2000
+#define ROUNDS 200000
+
+static Item* head = NULL;
+
+// Unlinks the node after the step-th one and pushes it back on the front.
+static void __attribute__((noinline)) move_to_front(const RuntimeAllocator* gc, long step)
+{
+    Item* before = head;
+    for (long i = 0; i<step && before->next->next; i++) before = before->next;
+
+    Item* moved = before->next;
+    gc->write_barrier(&before->next, moved->next);
+    before->next = moved->next;
+    gc->write_barrier(&moved->next, head);
+    moved->next = head;
+    head = moved;
+}
+
+static void __attribute__((noinline)) churn(const RuntimeAllocator* gc)
+{
+    for (long round = 0; round<ROUNDS; round++) {
+        long* garbage = gc->alloc(48);
+        garbage[0] = round;
+        move_to_front(gc, (round*7919)%LIST_LENGTH);
+    }
+}
+
+static void __attribute__((noinline)) check_list(void)
+{
+    long count = 0;
+    long sum = 0;
+    for (Item* item = head; item; item = item->next) {
+        count++;
+        sum += item->value;
+    }
+    assert(count==LIST_LENGTH);
+    assert(sum==(long) LIST_LENGTH*(LIST_LENGTH-1)/2);
+}
+
+int main(void)
+{
+    const RuntimeAllocator* gc = get_mark_sweep_allocator();
+    gc->register_root(&head);
+    gc->init();
+    gc->set_gc_mode(GC_MODE_INCREMENTAL);
+    gc->set_gc_step_budget(64);
+    gc->set_gc_threshold(256*1024);
+
+    push_items(gc, &head, LIST_LENGTH);
+    size_t list_bytes = gc->get_stats()->current_bytes;
+
+    churn(gc);
+    check_list();
+    assert(gc->get_stats()->max_pause_ns>0);
+
+    // A forced collection in the middle of a cycle finishes it.
+    gc->gc();
+    check_list();
+    assert(gc->get_stats()->current_bytes==list_bytes);
+
+    gc->set_gc_mode(GC_MODE_INCREMENTAL | GC_MODE_LAZY_SWEEP);
+    churn(gc);
+    check_list();
+
+    head = NULL;
+    clear_stack();
+    gc->gc();
+    assert(gc->get_stats()->current_bytes==0);
+
+    gc->shutdown();
+    printf("incremental marking test passed\n");
+    return 0;
+}
@@ -0,0 +1,114 @@
+#undef NDEBUG
+#define _DEFAULT_SOURCE
+#include "mark_sweep_allocator.h"
+#include "test_helpers.h"
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+// Big arrays go to the large-object space: they stay put while reachable,
+// including through interior pointers, only their pointer fields are traced
+// when they have a type, and their memory is handed back to the system as
+// soon as they die.
+
+#define ARRAY_LONGS (256*1024)
+#define CHURN 200
+
+typedef struct Node {
+  struct Node* next;
+  long value;
+} Node;
+
+typedef struct Table {
+  long count;
+  Node* first;
+  long values[ARRAY_LONGS];
+} Table;
+
+static const size_t table_pointers[] = {offsetof(Table, first)};
+static TypeDescriptor table_type = {1, table_pointers, 0};
+
+static Table* table = NULL;
+static long* numbers = NULL;
+static long* middle = NULL;
+// Addresses of dead arrays, hidden from the conservative scan.
+static uintptr_t hidden[2];
+
+static bool __attribute__((noinline)) mapped(uintptr_t hidden_address)
+{
+    void* address = (void*) (~hidden_address & ~(uintptr_t) 4095);
+    return msync(address, 4096, MS_ASYNC)==0 || errno!=ENOMEM;
+}
+
+static void __attribute__((noinline)) build(const RuntimeAllocator* gc)
+{
+    table = gc->alloc_typed(sizeof(Table), &table_type);
+    table->first = gc->alloc(sizeof(Node));
+    table->first->value = 42;
+
+    // A pointer-free array that happens to hold the only reference to a
+    // node. It isn't traced, so the node must not survive.
+    numbers = gc->alloc_typed(ARRAY_LONGS*sizeof(long), &runtime_pointer_free);
+    numbers[0] = (long) (uintptr_t) gc->alloc(sizeof(Node));
+    for (long i = 1; i<ARRAY_LONGS; i++) numbers[i] = i;
+
+    // Only reachable through a pointer into its middle.
+    long* untyped = gc->alloc(ARRAY_LONGS*sizeof(long));
+    untyped[ARRAY_LONGS/2] = 7;
+    middle = untyped+ARRAY_LONGS/2;
+
+    hidden[0] = ~(uintptr_t) gc->alloc(ARRAY_LONGS*sizeof(long));
+    hidden[1] = ~(uintptr_t) gc->alloc_typed(ARRAY_LONGS*sizeof(long), &runtime_pointer_free);
+}
+
+static void __attribute__((noinline)) churn(const RuntimeAllocator* gc)
+{
+    for (int i = 0; i<CHURN; i++) {
+        long* array = gc->alloc_typed(ARRAY_LONGS*sizeof(long), &runtime_pointer_free);
+        array[ARRAY_LONGS-1] = i;
+        if (i%2) gc->dealloc(array);
+    }
+}
+
+int main(void)
+{
+    const RuntimeAllocator* gc = get_mark_sweep_allocator();
+    gc->register_root(&table);
+    gc->register_root(&numbers);
+    gc->register_root(&middle);
+    gc->init();
+    gc->set_gc_threshold(SIZE_MAX);
+    AllocatorStats* stats = gc->get_stats();
+
+    build(gc);
+    assert(mapped(hidden[0]) && mapped(hidden[1]));
+    clear_stack();
+    gc->gc();
+
+    assert(!mapped(hidden[0]) && !mapped(hidden[1]));
+    assert(table->first->value==42);
+    assert(numbers[ARRAY_LONGS-1]==ARRAY_LONGS-1);
+    assert(*middle==7);
+    assert(stats->records[0].objects_freed==3);
+
+    // Freed explicitly or by a collection, none of them stays mapped.
+    churn(gc);
+    clear_stack();
+    gc->gc();
+    size_t live_bytes = stats->current_bytes;
+
+    table = NULL;
+    numbers = NULL;
+    middle = NULL;
+    clear_stack();
+    gc->gc();
+    assert(stats->current_bytes==0);
+    assert(live_bytes>3*ARRAY_LONGS*sizeof(long));
+
+    gc->shutdown();
+    printf("large object test passed\n");
+    return 0;
+}
@@ -0,0 +1,91 @@
+#undef NDEBUG
+#include "mark_sweep_allocator.h"
+#include "test_helpers.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+// Runs allocation-triggered collections with lazy sweeping on, or with
+// "concurrent" as the argument with a background thread sweeping after each
+// collection, and checks that nothing live was handed out again and that the
+// accounting matches a forced full collection.
+
+#define KEPT 1000
+#define CHURN 200000
+// Bigger than any size class, so these come from malloc and a concurrent
+// sweep leaves freeing them to its thread.
+#define BIG 2048
+
+static Item* kept = NULL;
+static long** big = NULL;
+
+static void __attribute__((noinline)) build_big(const RuntimeAllocator* gc)
+{
+    big = gc->alloc(KEPT*sizeof(long*));
+    for (long i = 0; i<KEPT; i++) {
+        big[i] = gc->alloc(BIG);
+        big[i][0] = i;
+    }
+}
+
+// Garbage of several size classes, so some pages are swept by allocations of
+// one class while the other classes' pages stay pending. Writes through
+// every fresh object, so reusing memory still in use shows up as a corrupted
+// kept object.
+static void __attribute__((noinline)) churn(const RuntimeAllocator* gc)
+{
+    for (long i = 0; i<CHURN; i++) {
+        size_t size = i%16 ? 16*(size_t) (i%8+1) : BIG;
+        long* garbage = gc->alloc(size);
+        memset(garbage, 0xff, size);
+    }
+}
+
+static void __attribute__((noinline)) check_kept(void)
+{
+    long index = KEPT-1;
+    for (Item* item = kept; item; item = item->next, index--) {
+        assert(item->value==index);
+        assert(big[index][0]==index);
+    }
+    assert(index==-1);
+}
+
+int main(int argc, char** argv)
+{
+    bool concurrent = argc>1 && strcmp(argv[1], "concurrent")==0;
+
+    const RuntimeAllocator* gc = get_mark_sweep_allocator();
+    gc->register_root(&kept);
+    gc->register_root(&big);
+    gc->init();
+    gc->set_gc_threshold(SIZE_MAX);
+
+    push_items(gc, &kept, KEPT);
+    build_big(gc);
+    AllocatorStats* stats = gc->get_stats();
+    size_t kept_bytes = stats->current_bytes;
+
+    gc->set_gc_mode(concurrent ? GC_MODE_CONCURRENT_SWEEP : GC_MODE_LAZY_SWEEP);
+    gc->set_gc_threshold(kept_bytes+64*1024);
+    churn(gc);
+    check_kept();
+
+    assert(stats->max_pause_ns>0);
+    assert(stats->current_bytes<=kept_bytes+64*1024+BIG);
+
+    gc->gc();
+    assert(stats->current_bytes==kept_bytes);
+    check_kept();
+
+    kept = NULL;
+    big = NULL;
+    clear_stack();
+    gc->gc();
+    assert(stats->current_bytes==0);
+
+    gc->shutdown();
+    printf("%s sweep test passed\n", concurrent ? "concurrent" : "lazy");
+    return 0;
+}
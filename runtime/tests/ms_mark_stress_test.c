@@ -0,0 +1,153 @@
+#undef NDEBUG
+#include "mark_sweep_allocator.h"
+#include "test_helpers.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdint.h>
+
+// Collects structures far deeper than the C stack could follow recursively.
+// Built twice: once with the default mark stack, and once with a tiny
+// MARK_STACK_LIMIT so the overflow rescan has to finish the job.
+
+#define LIST_LENGTH 1000000
+#define TREE_DEPTH 200000
+#define FAN_OUT 64
+
+typedef struct ListNode {
+  long value;
+  struct ListNode* next;
+} ListNode;
+
+typedef struct TreeNode {
+  struct TreeNode* left;
+  struct TreeNode* right;
+  long value;
+} TreeNode;
+
+typedef struct FanNode {
+  struct FanNode* children[FAN_OUT];
+} FanNode;
+
+static ListNode* list_head = NULL;
+static TreeNode* tree_root = NULL;
+static FanNode* fan_root = NULL;
+
+static void __attribute__((noinline)) build_list(const RuntimeAllocator* gc)
+{
+    ListNode* tail = NULL;
+    for (long i = 0; i<LIST_LENGTH; i++) {
+        ListNode* node = gc->alloc(sizeof(ListNode));
+        node->value = i;
+        if (tail) tail->next = node;
+        else list_head = node;
+        tail = node;
+    }
+}
+
+// A left-leaning spine where every spine node also carries a leaf, so both
+// depth and fan-out are exercised.
+static void __attribute__((noinline)) build_tree(const RuntimeAllocator* gc)
+{
+    TreeNode* node = NULL;
+    for (long i = 0; i<TREE_DEPTH; i++) {
+        TreeNode* parent = gc->alloc(sizeof(TreeNode));
+        parent->value = i;
+        parent->left = node;
+        parent->right = gc->alloc(sizeof(TreeNode));
+        node = parent;
+    }
+    tree_root = node;
+}
+
+// Two levels of wide nodes: pushes far more children at once than the small
+// mark stack can hold.
+static void __attribute__((noinline)) build_fan(const RuntimeAllocator* gc)
+{
+    fan_root = gc->alloc(sizeof(FanNode));
+    for (int i = 0; i<FAN_OUT; i++) {
+        FanNode* child = gc->alloc(sizeof(FanNode));
+        for (int j = 0; j<FAN_OUT; j++) {
+            child->children[j] = gc->alloc(sizeof(FanNode));
+        }
+        fan_root->children[i] = child;
+    }
+}
+
+// The stack is scanned conservatively, so helpers are kept out of line and
+// what they left behind is wiped before checking that everything unreachable
+// was freed.
+static void __attribute__((noinline)) truncate_list(long length)
+{
+    ListNode* node = list_head;
+    for (long i = 1; i<length; i++) node = node->next;
+    node->next = NULL;
+}
+
+static long __attribute__((noinline)) list_sum(void)
+{
+    long sum = 0;
+    for (ListNode* node = list_head; node; node = node->next) sum += node->value;
+    return sum;
+}
+
+static long __attribute__((noinline)) tree_depth(void)
+{
+    long depth = 0;
+    for (TreeNode* node = tree_root; node; node = node->left) {
+        assert(node->right);
+        depth++;
+    }
+    return depth;
+}
+
+int main(void)
+{
+    const RuntimeAllocator* gc = get_mark_sweep_allocator();
+    gc->register_root(&list_head);
+    gc->register_root(&tree_root);
+    gc->register_root(&fan_root);
+    gc->init();
+    gc->set_gc_threshold(SIZE_MAX);
+
+    build_list(gc);
+    size_t list_bytes = gc->get_stats()->current_bytes;
+    gc->gc();
+    assert(gc->get_stats()->current_bytes==list_bytes);
+
+    assert(list_sum()==(long) LIST_LENGTH*(LIST_LENGTH-1)/2);
+
+    truncate_list(LIST_LENGTH/2);
+    gc->gc();
+    assert(gc->get_stats()->current_bytes==list_bytes/2);
+
+    list_head = NULL;
+    clear_stack();
+    gc->gc();
+    assert(gc->get_stats()->current_bytes==0);
+
+    build_tree(gc);
+    size_t tree_bytes = gc->get_stats()->current_bytes;
+    gc->gc();
+    assert(gc->get_stats()->current_bytes==tree_bytes);
+
+    assert(tree_depth()==TREE_DEPTH);
+
+    tree_root = NULL;
+    clear_stack();
+    gc->gc();
+    assert(gc->get_stats()->current_bytes==0);
+
+    build_fan(gc);
+    size_t fan_bytes = gc->get_stats()->current_bytes;
+    gc->gc();
+    assert(gc->get_stats()->current_bytes==fan_bytes);
+
+    fan_root = NULL;
+    clear_stack();
+    gc->gc();
+    assert(gc->get_stats()->current_bytes==0);
+
+    gc->shutdown();
+    printf("mark stress test passed\n");
+    return 0;
+}
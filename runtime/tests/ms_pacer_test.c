@@ -0,0 +1,87 @@
+#undef NDEBUG
+#include "mark_sweep_allocator.h"
+#include "test_helpers.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdint.h>
+
+// Keeps a live heap well above the default 1 MB threshold and checks that the
+// pacer moves the trigger with it, so garbage is collected a handful of times
+// rather than on every allocation, and that a manual threshold still wins.
+
+#define LIVE_NODES 50000
+#define MB ((size_t) 1024*1024)
+
+typedef struct Node {
+  struct Node* next;
+  long payload[7];
+} Node;
+
+static Node* live = NULL;
+
+static void __attribute__((noinline)) build_live(const RuntimeAllocator* gc)
+{
+    for (long i = 0; i<LIVE_NODES; i++) {
+        Node* node = gc->alloc(sizeof(Node));
+        node->payload[0] = i;
+        node->next = live;
+        live = node;
+    }
+}
+
+// Returns how many collections the garbage set off.
+static int __attribute__((noinline)) churn(const RuntimeAllocator* gc, size_t bytes)
+{
+    AllocatorStats* stats = gc->get_stats();
+    int collections = 0;
+    size_t before = stats->current_bytes;
+    for (size_t allocated = 0; allocated<bytes; allocated += sizeof(Node)) {
+        gc->alloc(sizeof(Node));
+        assert(stats->current_bytes<=stats->next_gc_bytes+sizeof(Node));
+        if (stats->current_bytes<before) collections++;
+        before = stats->current_bytes;
+    }
+    return collections;
+}
+
+int main(void)
+{
+    const RuntimeAllocator* gc = get_mark_sweep_allocator();
+    gc->register_root(&live);
+    gc->init();
+    AllocatorStats* stats = gc->get_stats();
+    assert(stats->next_gc_bytes==MB);
+
+    build_live(gc);
+    gc->gc();
+    size_t live_bytes = stats->current_bytes;
+    assert(live_bytes>3*MB);
+    assert(stats->last_live_bytes==live_bytes);
+    assert(stats->next_gc_bytes==2*live_bytes);
+
+    // Eight times the live heap in garbage, with the trigger at twice the
+    // live heap, takes about eight collections.
+    int collections = churn(gc, 8*live_bytes);
+    assert(collections>=6 && collections<=10);
+    assert(stats->last_live_bytes<live_bytes+MB);
+
+    gc->set_gc_pacer(50, MB, 4*MB);
+    assert(stats->next_gc_bytes==4*MB);
+    churn(gc, 4*live_bytes);
+    assert(stats->next_gc_bytes==4*MB);
+
+    gc->set_gc_threshold(8*MB);
+    gc->gc();
+    assert(stats->next_gc_bytes==8*MB);
+
+    gc->set_gc_pacer(100, 2*MB, SIZE_MAX);
+    live = NULL;
+    clear_stack();
+    gc->gc();
+    assert(stats->current_bytes==0);
+    assert(stats->next_gc_bytes==2*MB);
+
+    gc->shutdown();
+    printf("pacer test passed\n");
+    return 0;
+}
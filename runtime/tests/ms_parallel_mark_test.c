@@ -0,0 +1,101 @@
+#undef NDEBUG
+#include "mark_sweep_allocator.h"
+#include "test_helpers.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdint.h>
+
+// Collects a random graph hanging off one big directory object with several
+// marker threads, so the directory gets split and the work stolen. Lazy
+// sweeping trusts the markers' counts, so any object marked twice or missed
+// shows up as a wrong byte total at the end.
+
+#define NODES 200000
+#define EDGES 3
+#define THREADS 4
+#define CHURN 1000000
+
+typedef struct Node {
+  struct Node* edges[EDGES];
+  long value;
+} Node;
+
+typedef struct Directory {
+  Node* nodes[NODES];
+} Directory;
+
+static Directory* directory = NULL;
+
+static uint64_t next_random(uint64_t* state)
+{
+    *state ^= *state<<13;
+    *state ^= *state>>7;
+    *state ^= *state<<17;
+    return *state;
+}
+
+static void __attribute__((noinline)) build_graph(const RuntimeAllocator* gc)
+{
+    directory = gc->alloc(sizeof(Directory));
+    for (long i = 0; i<NODES; i++) {
+        directory->nodes[i] = gc->alloc(sizeof(Node));
+        directory->nodes[i]->value = i;
+    }
+    uint64_t state = 2463534242ULL;
+    for (long i = 0; i<NODES; i++) {
+        for (int e = 0; e<EDGES; e++) {
+            directory->nodes[i]->edges[e] = directory->nodes[next_random(&state)%NODES];
+        }
+    }
+}
+
+static void __attribute__((noinline)) churn(const RuntimeAllocator* gc)
+{
+    for (long i = 0; i<CHURN; i++) {
+        long* garbage = gc->alloc(32);
+        garbage[0] = i;
+    }
+}
+
+static void __attribute__((noinline)) check_graph(void)
+{
+    for (long i = 0; i<NODES; i++) {
+        Node* node = directory->nodes[i];
+        assert(node->value==i);
+        for (int e = 0; e<EDGES; e++) {
+            assert(node->edges[e]->value>=0 && node->edges[e]->value<NODES);
+        }
+    }
+}
+
+int main(void)
+{
+    const RuntimeAllocator* gc = get_mark_sweep_allocator();
+    gc->register_root(&directory);
+    gc->init();
+    gc->set_gc_threads(THREADS);
+    gc->set_gc_threshold(SIZE_MAX);
+
+    build_graph(gc);
+    size_t graph_bytes = gc->get_stats()->current_bytes;
+    gc->gc();
+    assert(gc->get_stats()->current_bytes==graph_bytes);
+    check_graph();
+
+    gc->set_gc_mode(GC_MODE_LAZY_SWEEP);
+    gc->set_gc_threshold(graph_bytes+1024*1024);
+    churn(gc);
+    check_graph();
+
+    gc->gc();
+    assert(gc->get_stats()->current_bytes==graph_bytes);
+
+    directory = NULL;
+    clear_stack();
+    gc->gc();
+    assert(gc->get_stats()->current_bytes==0);
+
+    gc->shutdown();
+    printf("parallel mark test passed\n");
+    return 0;
+}
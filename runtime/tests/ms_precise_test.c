@@ -0,0 +1,111 @@
+#undef NDEBUG
+#include "mark_sweep_allocator.h"
+#include "test_helpers.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+
+// Objects allocated with a type descriptor are traced through their pointer
+// fields only, so a word that merely looks like a heap address no longer
+// keeps anything alive.
+
+typedef struct Node {
+  uintptr_t hash;
+  struct Node* next;
+  long value;
+} Node;
+
+static const size_t node_pointers[] = {offsetof(Node, next)};
+static TypeDescriptor node_type = {1, node_pointers, 0};
+
+#define BIG_SLOTS 300
+
+typedef struct Big {
+  long values[BIG_SLOTS];
+  struct Node* first;
+} Big;
+
+static const size_t big_pointers[] = {offsetof(Big, first)};
+static TypeDescriptor big_type = {1, big_pointers, 0};
+
+static Node* head = NULL;
+static Big* big = NULL;
+static uintptr_t* buffer = NULL;
+
+static size_t __attribute__((noinline)) node_size(const RuntimeAllocator* gc)
+{
+    Node* node = gc->alloc_typed(sizeof(Node), &node_type);
+    size_t size = gc->get_stats()->current_bytes;
+    gc->dealloc(node);
+    return size;
+}
+
+// A two-node list whose head also stores the address of a third node in a
+// field that isn't a pointer.
+static void __attribute__((noinline)) build_list(const RuntimeAllocator* gc)
+{
+    head = gc->alloc_typed(sizeof(Node), &node_type);
+    head->next = gc->alloc_typed(sizeof(Node), &node_type);
+    head->hash = (uintptr_t) gc->alloc_typed(sizeof(Node), &node_type);
+}
+
+// Pointer-free buffers are never scanned, whatever they hold.
+static void __attribute__((noinline)) build_buffer(const RuntimeAllocator* gc)
+{
+    buffer = gc->alloc_typed(4*sizeof(uintptr_t), &runtime_pointer_free);
+    buffer[0] = (uintptr_t) gc->alloc_typed(sizeof(Node), &node_type);
+}
+
+static void __attribute__((noinline)) build_big(const RuntimeAllocator* gc)
+{
+    big = gc->alloc_typed(sizeof(Big), &big_type);
+    big->first = gc->alloc_typed(sizeof(Node), &node_type);
+    big->values[0] = (long) gc->alloc_typed(sizeof(Node), &node_type);
+}
+
+int main(void)
+{
+    const RuntimeAllocator* gc = get_mark_sweep_allocator();
+    gc->register_root(&head);
+    gc->register_root(&big);
+    gc->register_root(&buffer);
+    gc->init();
+    gc->set_gc_threshold(SIZE_MAX);
+
+    size_t node_bytes = node_size(gc);
+
+    build_list(gc);
+    clear_stack();
+    gc->gc();
+    assert(gc->get_stats()->current_bytes==2*node_bytes);
+    assert(head->next);
+
+    head = NULL;
+    clear_stack();
+    gc->gc();
+    assert(gc->get_stats()->current_bytes==0);
+
+    build_buffer(gc);
+    size_t buffer_bytes = gc->get_stats()->current_bytes-node_bytes;
+    clear_stack();
+    gc->gc();
+    assert(gc->get_stats()->current_bytes==buffer_bytes);
+
+    buffer = NULL;
+    build_big(gc);
+    clear_stack();
+    gc->gc();
+    size_t big_bytes = gc->get_stats()->current_bytes-node_bytes;
+    assert(big_bytes>=sizeof(Big));
+    assert(big->first);
+
+    big = NULL;
+    clear_stack();
+    gc->gc();
+    assert(gc->get_stats()->current_bytes==0);
+
+    gc->shutdown();
+    printf("precise tracing test passed\n");
+    return 0;
+}
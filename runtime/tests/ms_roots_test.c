@@ -0,0 +1,89 @@
+#undef NDEBUG
+#include "mark_sweep_allocator.h"
+#include "test_helpers.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+// Thousands of globals, registered one at a time and through a static root
+// table like the one the compiler emits, all keep their objects alive.
+
+#define SINGLE_ROOTS 5000
+#define CACHE_SIZE 3000
+
+typedef struct Node {
+  struct Node* next;
+  long value;
+} Node;
+
+typedef struct Holder {
+  long count;
+  Node* first;
+  Node* second;
+} Holder;
+
+static Node* singles[SINGLE_ROOTS];
+static Node* cache[CACHE_SIZE];
+static Holder holders[2];
+
+static const size_t holder_offsets[] = {
+        offsetof(Holder, first), offsetof(Holder, second),
+        sizeof(Holder)+offsetof(Holder, first), sizeof(Holder)+offsetof(Holder, second)
+};
+
+static const RootEntry root_table[] = {
+        {cache, CACHE_SIZE, NULL},
+        {holders, 4, holder_offsets},
+};
+
+static void __attribute__((noinline)) fill(const RuntimeAllocator* gc)
+{
+    for (long i = 0; i<SINGLE_ROOTS; i++) {
+        singles[i] = gc->alloc(sizeof(Node));
+        singles[i]->value = i;
+    }
+    for (long i = 0; i<CACHE_SIZE; i++) {
+        cache[i] = gc->alloc(sizeof(Node));
+        cache[i]->next = gc->alloc(sizeof(Node));
+    }
+    for (int i = 0; i<2; i++) {
+        holders[i].first = gc->alloc(sizeof(Node));
+        holders[i].second = gc->alloc(sizeof(Node));
+    }
+}
+
+int main(void)
+{
+    const RuntimeAllocator* gc = get_mark_sweep_allocator();
+    for (int i = 0; i<SINGLE_ROOTS; i++) {
+        gc->register_root(&singles[i]);
+    }
+    gc->register_roots(root_table, sizeof(root_table)/sizeof(root_table[0]));
+    gc->init();
+    gc->set_gc_threshold(SIZE_MAX);
+
+    fill(gc);
+    size_t node_bytes = gc->get_stats()->current_bytes/(SINGLE_ROOTS+2*CACHE_SIZE+4);
+    clear_stack();
+    gc->gc();
+    assert(gc->get_stats()->current_bytes==(SINGLE_ROOTS+2*CACHE_SIZE+4)*node_bytes);
+    for (long i = 0; i<SINGLE_ROOTS; i++) assert(singles[i]->value==i);
+
+    memset(singles, 0, sizeof(singles));
+    holders[1].second = NULL;
+    clear_stack();
+    gc->gc();
+    assert(gc->get_stats()->current_bytes==(2*CACHE_SIZE+3)*node_bytes);
+
+    memset(cache, 0, sizeof(cache));
+    memset(holders, 0, sizeof(holders));
+    clear_stack();
+    gc->gc();
+    assert(gc->get_stats()->current_bytes==0);
+
+    gc->shutdown();
+    printf("roots test passed\n");
+    return 0;
+}
@@ -0,0 +1,124 @@
+#undef NDEBUG
+#include "mark_sweep_allocator.h"
+#include "gc_telemetry.h"
+#include "test_helpers.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+// Checks that each collection is counted once however much it frees, that
+// its record says why it ran and what it found, and that the pause
+// percentiles and the JSON dump agree with the histogram behind them.
+
+#define GARBAGE 10000
+#define NODE_BYTES 48
+
+static void* live = NULL;
+
+static void __attribute__((noinline)) make_garbage(const RuntimeAllocator* gc, int count)
+{
+    for (int i = 0; i<count; i++) {
+        gc->alloc(NODE_BYTES);
+    }
+}
+
+static const GcRecord* last_record(const AllocatorStats* stats)
+{
+    return &stats->records[(stats->total_collections-1)%GC_RECORD_HISTORY];
+}
+
+static void check_percentiles(void)
+{
+    static AllocatorStats stats;
+    for (int i = 0; i<99; i++) {
+        telemetry_record_pause(&stats, 1000);
+    }
+    telemetry_record_pause(&stats, 1000000);
+
+    assert(stats.pause_count==100);
+    assert(runtime_pause_percentile(&stats, 50)>=1000);
+    assert(runtime_pause_percentile(&stats, 50)<1250);
+    assert(runtime_pause_percentile(&stats, 99)==runtime_pause_percentile(&stats, 50));
+    assert(runtime_pause_percentile(&stats, 100)==1000000);
+}
+
+static void check_json(const AllocatorStats* stats)
+{
+    FILE* out = tmpfile();
+    telemetry_print_json(stats, "Mark-Sweep GC", out);
+    rewind(out);
+    char text[64*1024];
+    size_t length = fread(text, 1, sizeof(text)-1, out);
+    text[length] = '\0';
+    fclose(out);
+
+    char expected[64];
+    snprintf(expected, sizeof(expected), "\"total_collections\":%zu,", stats->total_collections);
+    assert(strstr(text, expected));
+    assert(strstr(text, "\"trigger\":\"explicit\""));
+    assert(strstr(text, "\"trigger\":\"threshold\""));
+    assert(strstr(text, "\"trigger\":\"nursery\""));
+    assert(strstr(text, "\"p99_ns\":"));
+    assert(text[length-2]=='}');
+}
+
+int main(void)
+{
+    check_percentiles();
+
+    const RuntimeAllocator* gc = get_mark_sweep_allocator();
+    gc->register_root(&live);
+    gc->init();
+    gc->set_gc_threshold(SIZE_MAX);
+    AllocatorStats* stats = gc->get_stats();
+
+    live = gc->alloc(NODE_BYTES);
+    size_t live_bytes = stats->current_bytes;
+    make_garbage(gc, GARBAGE);
+    clear_stack();
+    gc->gc();
+
+    const GcRecord* record = last_record(stats);
+    assert(stats->total_collections==1);
+    assert(record->trigger==GC_TRIGGER_EXPLICIT);
+    assert(record->objects_freed==GARBAGE);
+    assert(record->bytes_freed==GARBAGE*live_bytes);
+    assert(record->bytes_marked==live_bytes);
+    assert(record->mark_ns+record->sweep_ns==record->pause_ns);
+    assert(stats->total_objects_freed==GARBAGE);
+
+    // Enough garbage for several collections at a 64 KB threshold, each
+    // counted once and adding up to everything that was freed.
+    gc->set_gc_threshold(64*1024);
+    make_garbage(gc, GARBAGE);
+    size_t collections = stats->total_collections-1;
+    assert(collections>=GARBAGE*live_bytes/(64*1024)-1);
+    size_t freed = 0;
+    for (size_t n = 1; n<stats->total_collections; n++) {
+        assert(stats->records[n].trigger==GC_TRIGGER_THRESHOLD);
+        freed += stats->records[n].objects_freed;
+    }
+    assert(stats->total_objects_freed==GARBAGE+freed);
+
+    gc->set_gc_mode(GC_MODE_GENERATIONAL);
+    gc->set_nursery_size(16*1024);
+    gc->set_gc_threshold(SIZE_MAX);
+    make_garbage(gc, GARBAGE);
+    assert(last_record(stats)->trigger==GC_TRIGGER_NURSERY);
+
+    size_t bucketed = 0;
+    for (size_t i = 0; i<GC_PAUSE_BUCKETS; i++) {
+        bucketed += stats->pause_histogram[i];
+    }
+    assert(bucketed==stats->pause_count);
+    assert(stats->pause_count==stats->total_collections);
+    assert(runtime_pause_percentile(stats, 50)<=runtime_pause_percentile(stats, 99));
+    assert(runtime_pause_percentile(stats, 99)<=stats->max_pause_ns);
+    check_json(stats);
+
+    gc->shutdown();
+    assert(last_record(stats)->trigger==GC_TRIGGER_SHUTDOWN);
+    printf("telemetry test passed\n");
+    return 0;
+}
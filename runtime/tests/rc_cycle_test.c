@@ -0,0 +1,119 @@
+#undef NDEBUG
+#include "reference_count_allocator.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Garbage cycles, which counting alone never frees: a parent and child that
+// point at each other, a ring too long to traverse recursively, and enough
+// small cycles to fill the root buffer. A cycle that is still referenced from
+// outside must survive with its counts intact.
+
+#define RING_LENGTH 200000
+#define PAIRS 1000
+#define BUFFER 64
+
+typedef struct Node {
+  struct Node* next;
+  struct Node* other;
+  long value;
+} Node;
+
+static const RuntimeAllocator* rc;
+
+static void release_node(void* object)
+{
+    Node* self = object;
+    rc->dec_ref_count(self->next, 0);
+    rc->dec_ref_count(self->other, 0);
+}
+
+static const size_t node_pointers[] = {offsetof(Node, next), offsetof(Node, other)};
+static TypeDescriptor node_type = {2, node_pointers, 0, release_node};
+
+static Node* new_node(long value)
+{
+    Node* node = rc->alloc_typed(sizeof(Node), &node_type);
+    node->value = value;
+    return node;
+}
+
+// Stores a counted reference to target in *field.
+static void link(Node** field, Node* target)
+{
+    rc->inc_ref_count(target, NULL);
+    *field = target;
+}
+
+static Node* make_pair(void)
+{
+    Node* parent = new_node(1);
+    Node* child = new_node(2);
+    link(&parent->next, child);
+    link(&child->other, parent);
+    rc->dec_ref_count(child, 0);
+    return parent;
+}
+
+static Node* make_ring(long length)
+{
+    Node* head = new_node(0);
+    Node* tail = head;
+    for (long i = 1; i<length; i++) {
+        Node* node = new_node(i);
+        link(&tail->next, node);
+        rc->dec_ref_count(node, 0);
+        tail = node;
+    }
+    link(&tail->next, head);
+    return head;
+}
+
+int main(void)
+{
+    rc = get_reference_count_allocator();
+    rc->init();
+    AllocatorStats* stats = rc->get_stats();
+
+    rc->dec_ref_count(make_pair(), 0);
+    assert(stats->current_bytes>0);
+    assert(stats->cycle_roots==2);
+    rc->gc();
+    assert(stats->current_bytes==0);
+    assert(stats->cycle_objects_freed==2);
+    assert(stats->records[0].trigger==GC_TRIGGER_EXPLICIT);
+    assert(stats->records[0].objects_freed==2);
+
+    // Still referenced through the ring's head.
+    Node* head = make_ring(RING_LENGTH);
+    Node* second = head->next;
+    rc->inc_ref_count(second, NULL);
+    rc->dec_ref_count(second, 0);
+    rc->gc();
+    assert(stats->cycle_objects_freed==2);
+    long length = 1;
+    for (Node* node = head->next; node!=head; node = node->next) length++;
+    assert(length==RING_LENGTH);
+
+    rc->dec_ref_count(head, 0);
+    rc->gc();
+    assert(stats->cycle_objects_freed==2+RING_LENGTH);
+    assert(stats->current_bytes==0);
+
+    // Collected as the buffer fills, without an explicit request.
+    rc->set_cycle_buffer(BUFFER);
+    size_t collections = stats->total_collections;
+    for (int i = 0; i<PAIRS; i++) {
+        rc->dec_ref_count(make_pair(), 0);
+        assert(stats->cycle_roots<BUFFER);
+    }
+    assert(stats->total_collections-collections>=PAIRS/BUFFER);
+    assert(stats->records[collections%GC_RECORD_HISTORY].trigger==GC_TRIGGER_THRESHOLD);
+    rc->gc();
+    assert(stats->cycle_objects_freed==2+RING_LENGTH+2*PAIRS);
+    assert(stats->current_bytes==0);
+
+    rc->shutdown();
+    printf("cycle test passed\n");
+    return 0;
+}
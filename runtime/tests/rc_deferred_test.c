@@ -0,0 +1,104 @@
+#undef NDEBUG
+#include "reference_count_allocator.h"
+#include "test_helpers.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Under GC_MODE_DEFERRED only heap references are counted. Objects held by
+// a local or a global and nothing else must survive reconciliation, those
+// held by nothing at all must be freed by it, and dropping the last
+// reference to a list must free all of it however long it is.
+
+#define LIST_LENGTH 10000
+#define GARBAGE 20000
+
+typedef struct Node {
+  struct Node* next;
+  long value;
+} Node;
+
+static const RuntimeAllocator* rc;
+static Node* list;
+
+static void release_node(void* object)
+{
+    rc->dec_ref_count(((Node*) object)->next, 0);
+}
+
+static const size_t node_pointers[] = {offsetof(Node, next)};
+static TypeDescriptor node_type = {1, node_pointers, 0, release_node};
+
+static const RootEntry root_table[] = {
+        {&list, 1, NULL},
+};
+
+static void __attribute__((noinline)) build(void)
+{
+    // Each node is counted once, by the node in front of it; the head is
+    // held by the global alone.
+    Node* head = NULL;
+    for (long i = 0; i<LIST_LENGTH; i++) {
+        Node* node = rc->alloc_typed(sizeof(Node), &node_type);
+        node->value = i;
+        rc->inc_ref_count(head, node);
+        node->next = head;
+        head = node;
+    }
+    list = head;
+}
+
+static void __attribute__((noinline)) litter(void)
+{
+    for (long i = 0; i<GARBAGE; i++) {
+        Node* node = rc->alloc_typed(sizeof(Node), &node_type);
+        node->value = i;
+    }
+}
+
+int main(void)
+{
+    rc = get_reference_count_allocator();
+    rc->init();
+    rc->set_stack_bottom(__builtin_frame_address(0));
+    rc->set_gc_mode(GC_MODE_DEFERRED);
+    rc->register_roots(root_table, 1);
+    AllocatorStats* stats = rc->get_stats();
+
+    build();
+    size_t list_bytes = stats->current_bytes;
+    size_t node_bytes = list_bytes/LIST_LENGTH;
+    assert(stats->total_increments==LIST_LENGTH);
+
+    // Enough garbage to reconcile along the way.
+    litter();
+    assert(stats->total_collections>0);
+    clear_stack();
+    rc->gc();
+    assert(stats->current_bytes==list_bytes);
+    long expected = LIST_LENGTH-1;
+    for (Node* node = list; node; node = node->next) {
+        assert(node->value==expected--);
+    }
+
+    Node* local = rc->alloc_typed(sizeof(Node), &node_type);
+    local->value = 42;
+    clear_stack();
+    rc->gc();
+    assert(local->value==42);
+    assert(stats->current_bytes==list_bytes+node_bytes);
+
+    list = NULL;
+    clear_stack();
+    rc->gc();
+    assert(stats->current_bytes==node_bytes);
+    assert(stats->total_objects_freed==LIST_LENGTH+GARBAGE);
+    assert(local->value==42);
+    // One by the release of each freed node, none for locals.
+    assert(stats->total_decrements==LIST_LENGTH+GARBAGE);
+
+    rc->shutdown();
+    assert(stats->current_bytes==0);
+    printf("deferred test passed\n");
+    return 0;
+}
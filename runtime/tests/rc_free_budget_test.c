@@ -0,0 +1,66 @@
+#undef NDEBUG
+#include "reference_count_allocator.h"
+#include <assert.h>
+#include <stdio.h>
+
+// Dropping the head of a list far longer than the C stack could recurse
+// through frees all of it, and with a budget the same cascade is spread over
+// later allocations, a few objects at a time.
+
+#define LIST_LENGTH 2000000
+#define BUDGET 16
+
+typedef struct Node {
+  struct Node* next;
+  long value;
+} Node;
+
+static void release_node(void* object)
+{
+    get_reference_count_allocator()->dec_ref_count(((Node*) object)->next, 0);
+}
+
+static TypeDescriptor node_type = {0, NULL, 0, release_node};
+
+static Node* build(const RuntimeAllocator* rc, long length)
+{
+    Node* head = NULL;
+    for (long i = 0; i<length; i++) {
+        Node* node = rc->alloc_typed(sizeof(Node), &node_type);
+        node->next = head;
+        node->value = i;
+        head = node;
+    }
+    return head;
+}
+
+int main(void)
+{
+    const RuntimeAllocator* rc = get_reference_count_allocator();
+    rc->init();
+    AllocatorStats* stats = rc->get_stats();
+
+    rc->dec_ref_count(build(rc, LIST_LENGTH), 0);
+    assert(stats->total_objects_freed==LIST_LENGTH);
+    assert(stats->current_bytes==0);
+
+    rc->set_free_budget(BUDGET);
+    Node* head = build(rc, 1000);
+    size_t node_bytes = stats->current_bytes/1000;
+    rc->dec_ref_count(head, 0);
+    assert(stats->total_objects_freed==LIST_LENGTH+BUDGET);
+
+    // Each allocation frees another budget's worth first.
+    void* extra = rc->alloc(sizeof(Node));
+    assert(stats->total_objects_freed==LIST_LENGTH+2*BUDGET);
+    assert(stats->current_bytes>(1000-2*BUDGET)*node_bytes);
+
+    rc->gc();
+    assert(stats->total_objects_freed==LIST_LENGTH+1000);
+    rc->dec_ref_count(extra, 0);
+    assert(stats->current_bytes==0);
+
+    rc->shutdown();
+    printf("free budget test passed\n");
+    return 0;
+}
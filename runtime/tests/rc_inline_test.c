@@ -0,0 +1,66 @@
+#undef NDEBUG
+#include "runtime.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Built with USE_REF_COUNT, so counts are updated inline. Objects must still
+// be freed when their count drops to zero, counted in the stats, buffered as
+// cycle roots only when they hold counted references, and collected when they
+// form a cycle.
+
+typedef struct Node {
+  struct Node* next;
+  long value;
+} Node;
+
+static void release_node(void* object)
+{
+    runtime_dec_ref_count(((Node*) object)->next, 0);
+}
+
+static const size_t node_pointers[] = {offsetof(Node, next)};
+static TypeDescriptor node_type = {1, node_pointers, 0, release_node};
+
+int main(void)
+{
+    runtime_init();
+    AllocatorStats* stats = runtime_get_stats();
+
+    long* number = runtime_alloc_typed(sizeof(long), &runtime_pointer_free);
+    runtime_inc_ref_count(number, NULL);
+    runtime_dec_ref_count(number, 0);
+    assert(stats->cycle_roots==0);
+    runtime_dec_ref_count(number, 0);
+    assert(stats->total_objects_freed==1);
+
+    Node* head = runtime_alloc_typed(sizeof(Node), &node_type);
+    head->next = runtime_alloc_typed(sizeof(Node), &node_type);
+    runtime_inc_ref_count(head, NULL);
+    runtime_dec_ref_count(head, 0);
+    assert(stats->cycle_roots==1);
+    runtime_dec_ref_count(head, 0);
+    assert(stats->total_objects_freed==3);
+    assert(stats->cycle_roots==0);
+
+    Node* first = runtime_alloc_typed(sizeof(Node), &node_type);
+    Node* second = runtime_alloc_typed(sizeof(Node), &node_type);
+    first->next = second;
+    runtime_inc_ref_count(second, NULL);
+    second->next = first;
+    runtime_inc_ref_count(first, NULL);
+    runtime_dec_ref_count(first, 0);
+    runtime_dec_ref_count(second, 0);
+    assert(stats->cycle_roots==2);
+    assert(stats->current_bytes>0);
+    runtime_gc();
+    assert(stats->cycle_objects_freed==2);
+    assert(stats->current_bytes==0);
+
+    // Releasing the second node of the list drops its null next as well.
+    assert(stats->total_increments==4);
+    assert(stats->total_decrements==8);
+    runtime_shutdown();
+    printf("inline test passed\n");
+    return 0;
+}
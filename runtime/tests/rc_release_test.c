@@ -0,0 +1,61 @@
+#undef NDEBUG
+#include "reference_count_allocator.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// A node with more children than the old header had room for: releasing it
+// must drop every child, and a child shared with another node must outlive
+// it until that node lets go too.
+
+#define CHILDREN 8
+
+typedef struct Node {
+  struct Node* children[CHILDREN];
+  long value;
+} Node;
+
+static void release_node(void* object)
+{
+    const RuntimeAllocator* rc = get_reference_count_allocator();
+    Node* self = object;
+    for (int i = 0; i<CHILDREN; i++) {
+        rc->dec_ref_count(self->children[i], 0);
+    }
+}
+
+static TypeDescriptor node_type = {0, NULL, 0, release_node};
+
+int main(void)
+{
+    const RuntimeAllocator* rc = get_reference_count_allocator();
+    rc->init();
+    AllocatorStats* stats = rc->get_stats();
+
+    Node* parent = rc->alloc_typed(sizeof(Node), &node_type);
+    Node* other = rc->alloc_typed(sizeof(Node), &node_type);
+    for (int i = 0; i<CHILDREN; i++) {
+        parent->children[i] = rc->alloc_typed(sizeof(Node), &node_type);
+        parent->children[i]->value = i;
+    }
+    Node* shared = parent->children[CHILDREN-1];
+    rc->inc_ref_count(shared, other);
+    other->children[0] = shared;
+
+    rc->dec_ref_count(parent, 0);
+    assert(stats->total_objects_freed==CHILDREN);
+    assert(other->children[0]->value==CHILDREN-1);
+
+    rc->dec_ref_count(other, 0);
+    assert(stats->total_objects_freed==CHILDREN+2);
+    assert(stats->current_bytes==0);
+
+    // Untyped objects hold no counted references.
+    void* untyped = rc->alloc(sizeof(Node));
+    rc->dec_ref_count(untyped, 0);
+    assert(stats->current_bytes==0);
+
+    rc->shutdown();
+    printf("release test passed\n");
+    return 0;
+}
@@ -0,0 +1,128 @@
+#undef NDEBUG
+#include "reference_count_allocator.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+
+// Threads share a list the main thread owns, counting its nodes up and down
+// at the same time; hand objects they allocated over to the main thread and
+// exit; and drop the last references to an object whose owner is still
+// running, which it frees once it merges its counts. Everything must be
+// freed exactly once, with nothing left over.
+
+#define THREADS 4
+#define LIST_LENGTH 1000
+#define ROUNDS 200
+#define HANDED_OVER 1000
+
+typedef struct Node {
+  struct Node* next;
+  long value;
+} Node;
+
+static const RuntimeAllocator* rc;
+
+static void release_node(void* object)
+{
+    rc->dec_ref_count(((Node*) object)->next, 0);
+}
+
+static TypeDescriptor node_type = {0, NULL, 0, release_node};
+
+static Node* shared_list = NULL;
+static Node* handed_over[THREADS][HANDED_OVER];
+static Node* dropped = NULL;
+
+static void* count_shared(void* arg)
+{
+    (void) arg;
+    for (int round = 0; round<ROUNDS; round++) {
+        for (Node* node = shared_list; node; node = node->next) {
+            rc->inc_ref_count(node, NULL);
+        }
+        for (Node* node = shared_list; node; node = node->next) {
+            rc->dec_ref_count(node, 0);
+        }
+    }
+    return NULL;
+}
+
+static void* hand_over(void* arg)
+{
+    Node** slots = arg;
+    for (int i = 0; i<HANDED_OVER; i++) {
+        Node* node = rc->alloc_typed(sizeof(Node), &node_type);
+        rc->inc_ref_count(node, NULL);
+        rc->dec_ref_count(node, 0);
+        node->next = i>0 && i%2 ? slots[i-1] : NULL;
+        if (node->next) rc->inc_ref_count(node->next, NULL);
+        slots[i] = node;
+    }
+    return NULL;
+}
+
+static void* drop_twice(void* arg)
+{
+    (void) arg;
+    rc->dec_ref_count(dropped, 0);
+    rc->dec_ref_count(dropped, 0);
+    return NULL;
+}
+
+static void run_threads(void* (* body)(void*), bool per_thread)
+{
+    pthread_t threads[THREADS];
+    for (int i = 0; i<THREADS; i++) {
+        pthread_create(&threads[i], NULL, body, per_thread ? handed_over[i] : NULL);
+    }
+    for (int i = 0; i<THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+int main(void)
+{
+    rc = get_reference_count_allocator();
+    rc->init();
+    rc->set_gc_mode(GC_MODE_THREAD_SAFE);
+    AllocatorStats* stats = rc->get_stats();
+
+    for (long i = 0; i<LIST_LENGTH; i++) {
+        Node* node = rc->alloc_typed(sizeof(Node), &node_type);
+        node->next = shared_list;
+        node->value = i;
+        shared_list = node;
+    }
+    size_t list_bytes = stats->current_bytes;
+    run_threads(count_shared, false);
+    rc->get_stats();
+    assert(stats->current_bytes==list_bytes);
+    assert(stats->shared_updates==2*THREADS*ROUNDS*LIST_LENGTH);
+
+    // Their owners are gone, so the main thread merges them itself.
+    run_threads(hand_over, true);
+    assert(stats->total_allocations==LIST_LENGTH+THREADS*HANDED_OVER);
+    for (int i = 0; i<THREADS; i++) {
+        for (int j = 0; j<HANDED_OVER; j++) {
+            rc->dec_ref_count(handed_over[i][j], 0);
+        }
+    }
+    assert(stats->current_bytes==list_bytes);
+
+    dropped = rc->alloc_typed(sizeof(Node), &node_type);
+    rc->inc_ref_count(dropped, NULL);
+    pthread_t dropper;
+    pthread_create(&dropper, NULL, drop_twice, NULL);
+    pthread_join(dropper, NULL);
+    assert(stats->current_bytes>list_bytes);
+    rc->scope_end();
+    assert(stats->current_bytes==list_bytes);
+
+    rc->dec_ref_count(shared_list, 0);
+    assert(stats->current_bytes==0);
+    assert(stats->total_objects_freed==stats->total_allocations);
+
+    rc->shutdown();
+    printf("threads test passed\n");
+    return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef TEST_HELPERS_H
+#define TEST_HELPERS_H
+
+#include <string.h>
+#include "allocator_interface.h"
+
+// Scaffolding shared by the collector tests.
+
+typedef struct Item {
+  struct Item* next;
+  long value;
+} Item;
+
+// Pushes count items valued 0 to count-1 onto *head, so the last one pushed
+// is first. Kept out of line so no pointer to an item lingers in the
+// caller's frame.
+static void __attribute__((noinline, unused)) push_items(const RuntimeAllocator* gc, Item** head, long count)
+{
+    for (long i = 0; i<count; i++) {
+        Item* item = gc->alloc(sizeof(Item));
+        item->value = i;
+        if (gc->write_barrier) gc->write_barrier(&item->next, *head);
+        item->next = *head;
+        *head = item;
+    }
+}
+
+// Overwrites the stack below the caller, so pointers left there by earlier
+// calls don't keep anything alive once the collector scans it.
+static void __attribute__((noinline, unused)) clear_stack(void)
+{
+    char scratch[16*1024];
+    memset(scratch, 0, sizeof(scratch));
+    __asm__ volatile("" : : "r"(scratch) : "memory");
+}
+
+#endif
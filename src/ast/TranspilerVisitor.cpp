@@ -62,15 +62,58 @@ antlrcpp::Any TranspilerVisitor::visitProgram(JBLangParser::ProgramContext* ctx)
 
 //    generateClassMethodBodies();
 
+    auto roots = getGlobalRoots();
+    m_output << m_codeGen->generateRootTable(roots);
     m_output << "int main() {\n    runtime_init();\n";
-    for (const auto& [name, type] : m_symbolTable->globalVars) {
-        m_output << "    runtime_register_root(&" << name << ");\n";
+    std::istringstream setup(m_codeGen->generateRuntimeSetup());
+    for (std::string line; std::getline(setup, line);) {
+        m_output << "    " << line << "\n";
+    }
+    if (!roots.empty()) {
+        m_output << "    " << m_codeGen->generateRootRegistration(roots);
     }
     m_output << "    main_();\n    runtime_shutdown();\n}\n";
 
     return m_output.str();
 }
 
+std::vector<GlobalRoot> TranspilerVisitor::getGlobalRoots() const
+{
+    std::vector<GlobalRoot> roots;
+    for (const auto& [name, type] : m_symbolTable->globalVars) {
+        size_t elements = 1;
+        if (type.isArray()) {
+            for (int size : type.getArraySizes()) {
+                elements *= size;
+            }
+        }
+
+        GlobalRoot root;
+        root.name = name;
+        if (type.isPointer()) {
+            root.pointerCount = elements;
+        }
+        else if (type.isStruct() || type.isClass()) {
+            std::string structType = "struct "+type.getStructName();
+            auto fields = m_typeSystem->getPointerFields(type.getStructName());
+            for (size_t i = 0; i<elements; ++i) {
+                for (const auto& field : fields) {
+                    std::string offset = "offsetof("+structType+", "+field+")";
+                    if (i>0) {
+                        offset += "+"+std::to_string(i)+"*sizeof("+structType+")";
+                    }
+                    root.pointerOffsets.push_back(offset);
+                }
+            }
+            root.pointerCount = root.pointerOffsets.size();
+        }
+        if (root.pointerCount>0) {
+            roots.push_back(std::move(root));
+        }
+    }
+    return roots;
+}
+
 Type TranspilerVisitor::getArrayFromCode(JBLangParser::ArrayDeclContext* ctx)
 {
     Type type = resolveTypeFromContext(ctx->typeSpec());
@@ -117,6 +160,11 @@ antlrcpp::Any TranspilerVisitor::visitFunctionDecl(JBLangParser::FunctionDeclCon
             Type::BaseType::Void);
 
     if (m_first_pass) {
+        std::set<std::string> escaping;
+        findEscapingNames(ctx->block(), escaping);
+        for (const auto& param : func->params) {
+            func->borrowedParams.push_back(param.second.isPointer() && !escaping.count(param.first));
+        }
         m_typeSystem->registerFunction(func);
     }
     m_symbolTable->currentFunc = func;
@@ -129,6 +177,77 @@ antlrcpp::Any TranspilerVisitor::visitFunctionDecl(JBLangParser::FunctionDeclCon
     return nullptr;
 }
 
+// Expressions whose value a function body stores, returns or overwrites.
+void TranspilerVisitor::findEscapingNames(antlr4::tree::ParseTree* tree, std::set<std::string>& names)
+{
+    if (auto assign = dynamic_cast<JBLangParser::AssignExprContext*>(tree)) {
+        names.insert(assign->expression(0)->getText());
+        names.insert(assign->expression(1)->getText());
+    }
+    else if (auto decl = dynamic_cast<JBLangParser::VarDeclContext*>(tree)) {
+        if (decl->expression()) names.insert(decl->expression()->getText());
+    }
+    else if (auto ret = dynamic_cast<JBLangParser::ReturnStmtContext*>(tree)) {
+        if (ret->expression()) names.insert(ret->expression()->getText());
+    }
+    else if (auto init = dynamic_cast<JBLangParser::InitializerContext*>(tree)) {
+        names.insert(init->expression()->getText());
+    }
+    for (auto child : tree->children) {
+        findEscapingNames(child, names);
+    }
+}
+
+// Every name a statement mentions.
+void TranspilerVisitor::findNames(antlr4::tree::ParseTree* tree, std::set<std::string>& names)
+{
+    if (dynamic_cast<antlr4::tree::TerminalNode*>(tree)) {
+        names.insert(tree->getText());
+    }
+    for (auto child : tree->children) {
+        findNames(child, names);
+    }
+}
+
+// Drops a local's reference before the end of its scope, once.
+void TranspilerVisitor::releaseLocal(const std::string& name, const std::string& indentLevel)
+{
+    Variable var;
+    if (m_symbolTable->lookupSymbol(name, var) && var.type.isPointer() && !m_symbolTable->isReleased(name)) {
+        std::string release = m_codeGen->generateDecRef(var);
+        if (!release.empty()) {
+            m_output << indentLevel << release;
+        }
+        m_symbolTable->setReleased(name, true);
+    }
+}
+
+// The blocks that run whenever the statement does, on one path or another:
+// a nested block, or both branches of an if when each is a block.
+static std::vector<JBLangParser::BlockContext*> pathBlocks(JBLangParser::StatementContext* stmt)
+{
+    if (stmt->block()) {
+        return {stmt->block()};
+    }
+    auto branch = stmt->ifStmt();
+    if (branch && branch->statement(1) && branch->statement(0)->block() && branch->statement(1)->block()) {
+        return {branch->statement(0)->block(), branch->statement(1)->block()};
+    }
+    return {};
+}
+
+// Whether a block declares name itself, hiding the one outside it.
+static bool declares(JBLangParser::BlockContext* block, const std::string& name)
+{
+    for (auto stmt : block->statement()) {
+        auto decl = stmt->varDecl();
+        if (decl && decl->IDENTIFIER() && decl->IDENTIFIER()->getText()==name) {
+            return true;
+        }
+    }
+    return false;
+}
+
 antlrcpp::Any TranspilerVisitor::visitVarDecl(JBLangParser::VarDeclContext* ctx)
 {
     try {
@@ -143,7 +262,7 @@ antlrcpp::Any TranspilerVisitor::visitVarDecl(JBLangParser::VarDeclContext* ctx)
             varName = ctx->IDENTIFIER()->getText();
             varType = resolveTypeFromContext(ctx->typeSpec());
         }
-        if (m_symbolTable->isGlobalScope() && varType.isPointer() && m_first_pass) {
+        if (m_symbolTable->isGlobalScope() && m_first_pass) {
             m_symbolTable->globalVars.emplace_back(varName, varType);
         }
         if (!m_first_pass) {
@@ -157,8 +276,7 @@ antlrcpp::Any TranspilerVisitor::visitVarDecl(JBLangParser::VarDeclContext* ctx)
                     }
                 }
                 Variable assignedFrom;
-                bool found = m_symbolTable->lookupSymbol(initExpr, assignedFrom);
-                if (found && assignedFrom.type.isPointer()) {
+                if (lookupCountedPointer(initExpr, assignedFrom)) {
                     m_output << indentLevel << m_codeGen->generateIncRef(assignedFrom);
                 }
                 m_output << indentLevel << m_codeGen->generateVarDecl(varName, varType, " = "+initExpr);
@@ -184,18 +302,97 @@ antlrcpp::Any TranspilerVisitor::visitBlock(JBLangParser::BlockContext* ctx)
     }
 
     std::string indentLevel = m_symbolTable->getIndentLevel();
+    auto statements = ctx->statement();
+
+    // A local is released straight after the last statement that names it
+    // rather than at the end of the block, and so is one an enclosing block
+    // handed down. When that statement is a nested block, or an if with a
+    // block on each side, the local is handed down to them in turn, to be
+    // released wherever it dies on each path.
+    std::vector<std::string> handedDown = m_handedDown[ctx];
+    m_handedDown.erase(ctx);
+    std::map<std::string, size_t> lastUse;
+    for (const auto& name : handedDown) {
+        lastUse[name] = 0;
+    }
+    for (auto stmt : statements) {
+        if (stmt->varDecl() && stmt->varDecl()->IDENTIFIER()) {
+            lastUse[stmt->varDecl()->IDENTIFIER()->getText()] = 0;
+        }
+    }
+    for (size_t i = 0; i<statements.size(); ++i) {
+        std::set<std::string> names;
+        findNames(statements[i], names);
+        for (auto& [name, last] : lastUse) {
+            if (names.count(name)) {
+                last = i+1;
+            }
+        }
+    }
+
+    if (!m_first_pass) {
+        for (const auto& name : handedDown) {
+            if (lastUse[name]==0) {
+                releaseLocal(name, indentLevel);
+            }
+        }
+    }
+
+    // Nothing after a return is reached, the releases at the end of the
+    // block included; the return has made its own.
+    bool returned = false;
+    for (size_t i = 0; i<statements.size(); ++i) {
+        auto stmt = statements[i];
+        std::vector<std::string> dying;
+        for (const auto& [name, last] : lastUse) {
+            if (last==i+1) {
+                dying.push_back(name);
+            }
+        }
+
+        auto paths = pathBlocks(stmt);
+        std::set<std::string> passed;
+        for (const auto& name : dying) {
+            bool hidden = false;
+            for (auto path : paths) {
+                hidden = hidden || declares(path, name);
+            }
+            if (!m_first_pass && !paths.empty() && !hidden) {
+                for (auto path : paths) {
+                    m_handedDown[path].push_back(name);
+                }
+                passed.insert(name);
+            }
+        }
 
-    for (auto stmt : ctx->statement()) {
         visit(stmt);
+        if (stmt->returnStmt()) {
+            returned = true;
+            break;
+        }
+        if (!m_first_pass) {
+            for (const auto& name : dying) {
+                if (passed.count(name)) {
+                    m_symbolTable->setReleased(name, true);
+                }
+                else {
+                    releaseLocal(name, indentLevel);
+                }
+            }
+        }
     }
 
-    if (!m_first_pass) {
+    if (!m_first_pass && !returned) {
         for (const auto& var : m_symbolTable->getCurrentScopeSymbols()) {
-            if (var.second.type.isPointer()) {
+            if (var.second.type.isPointer() && !m_symbolTable->isReleased(var.first)) {
                 m_output << indentLevel << m_codeGen->generateDecRef(var.second);
             }
         }
     }
+    // The next path starts out holding what this one released.
+    for (const auto& name : handedDown) {
+        m_symbolTable->setReleased(name, false);
+    }
 
     m_symbolTable->exitScope();
     if (!m_first_pass) {
@@ -216,21 +413,46 @@ antlrcpp::Any TranspilerVisitor::visitReturnStmt(JBLangParser::ReturnStmtContext
     this->addRefCounts = false;
     auto returnExpr = std::any_cast<std::string>(visit(ctx->expression()));
     this->addRefCounts = true;
-    bool found = m_symbolTable->lookupSymbol(returnExpr, returnedVariable);
-    if (found && returnedVariable.type.isPointer() && !m_first_pass) {
-        m_output << m_symbolTable->getIndentLevel() << m_codeGen->generateIncRef(returnedVariable);
+    bool found = lookupCountedPointer(returnExpr, returnedVariable);
+    auto locals = m_symbolTable->getLocalSymbols();
+
+    // A returned local hands its reference to the caller instead of taking
+    // another and dropping its own. Anything else, such as a parameter or a
+    // field, is only borrowed and needs one of its own.
+    bool moved = false;
+    if (found) {
+        for (const auto& var : locals) {
+            moved = moved || var.name==returnExpr;
+        }
+    }
+    if (m_first_pass) {
+        return nullptr;
     }
 
     std::string indentLevel = m_symbolTable->getIndentLevel();
-    for (const auto& var : m_symbolTable->getCurrentScopeSymbols()) {
-        if (var.second.type.isPointer() && !m_first_pass) {
-            m_output << indentLevel << m_codeGen->generateDecRef(var.second);
+    std::string releases;
+    for (const auto& var : locals) {
+        std::string release = var.type.isPointer() && !(moved && var.name==returnExpr)
+                && !m_symbolTable->isReleased(var.name) ? m_codeGen->generateDecRef(var) : "";
+        if (!release.empty()) {
+            releases += indentLevel+release;
         }
     }
 
-    if (!m_first_pass) {
-        m_output << indentLevel << m_codeGen->generateReturn(returnExpr, Type(Type::BaseType::NO_TYPE));
+    // The value is read before the locals it may be read through are
+    // released.
+    if (!moved && !releases.empty() && ctx->expression() && m_symbolTable->currentFunc) {
+        std::string result = "temp_"+std::to_string(m_tempVarCounter++);
+        m_output << indentLevel << m_codeGen->generateVarDecl(result, m_symbolTable->currentFunc->returnType,
+                " = "+returnExpr);
+        returnExpr = result;
+        returnedVariable.name = result;
+    }
+    if (found && !moved) {
+        m_output << indentLevel << m_codeGen->generateIncRef(returnedVariable);
     }
+    m_output << releases;
+    m_output << indentLevel << m_codeGen->generateReturn(returnExpr, Type(Type::BaseType::NO_TYPE));
     return nullptr;
 }
 
@@ -363,6 +585,12 @@ antlrcpp::Any TranspilerVisitor::visitAssignExpr(JBLangParser::AssignExprContext
     auto left = std::any_cast<std::string>(visit(ctx->expression(0)));
     auto right = std::any_cast<std::string>(visit(ctx->expression(1)));
 
+    // Storing a pointer back where it was read from would take a reference
+    // only to drop it straight away.
+    if (left==right) {
+        return left+" = "+right;
+    }
+
     Variable leftVar, rightVar;
     bool leftFound = m_symbolTable->lookupSymbol(left, leftVar);
     bool rightFound = m_symbolTable->lookupSymbol(right, rightVar);
@@ -373,27 +601,45 @@ antlrcpp::Any TranspilerVisitor::visitAssignExpr(JBLangParser::AssignExprContext
         }
     }
 
+    // The new value is counted before the old one is released, which may
+    // be what it was read through.
+    bool heapSlot = isHeapSlot(ctx->expression(0));
+    size_t holderEnd = left.rfind("->");
+    std::string holder = heapSlot && holderEnd!=std::string::npos ? left.substr(0, holderEnd) : "NULL";
     Variable assignedFrom;
-    bool found = m_symbolTable->lookupSymbol(right, assignedFrom);
-    if (found && assignedFrom.type.isPointer()) {
-        // check if we are assigning to a struct pointer
-        Variable assignedTo;
-        size_t pos = left.find("->");
-        if (pos!=std::string::npos) {
-            found = m_symbolTable->lookupSymbol(left.substr(0, pos), assignedTo);
-            if (found && assignedTo.type.isPointer()) {
-                m_output << m_symbolTable->getIndentLevel() << m_codeGen->generateIncRef(assignedFrom, assignedTo.name);
-            }
-        }
-        else {
-            m_output << m_symbolTable->getIndentLevel() << m_codeGen->generateIncRef(assignedFrom);
-        }
+    bool counted = false;
+    if (lookupCountedPointer(right, assignedFrom)) {
+        m_output << m_symbolTable->getIndentLevel() << m_codeGen->generateIncRef(assignedFrom, holder, heapSlot);
+        counted = heapSlot;
     }
-    found = m_symbolTable->lookupSymbol(left, assignedFrom);
+    bool found = m_symbolTable->lookupSymbol(left, assignedFrom);
     if (found && assignedFrom.type.isPointer()) {
         m_output << m_symbolTable->getIndentLevel() << m_codeGen->generateDecRef(assignedFrom);
     }
 
+    Type fieldType;
+    if (heapSlot && holderEnd!=std::string::npos && resolveMemberType(left, fieldType) && fieldType.isPointer()) {
+        // The field gives up its reference to the old value, which its type's
+        // release function would otherwise drop when the object is freed.
+        std::string release = fieldType.getBaseType()==Type::BaseType::String ? ""
+                : m_codeGen->generateDecRef(Variable(left, fieldType), true);
+        if (!release.empty()) {
+            m_output << m_symbolTable->getIndentLevel() << release;
+        }
+        std::string barrier = m_codeGen->generateWriteBarrier(left, rightFound ? right : "NULL");
+        if (!barrier.empty()) {
+            m_output << m_symbolTable->getIndentLevel() << barrier;
+        }
+        // A pointer from a variable or a field was counted above; anything
+        // else but a null, such as a call's result, is counted once stored.
+        bool null = right=="NULL" || right=="0" || m_typeSystem->getDefineValue(right)=="0";
+        std::string stored = counted || null || fieldType.getBaseType()==Type::BaseType::String ? ""
+                : m_codeGen->generateStoreRef(left, holder);
+        if (!stored.empty()) {
+            return left+" = "+right+", "+stored;
+        }
+    }
+
     return left+" = "+right;
 }
 
@@ -445,16 +691,25 @@ antlrcpp::Any TranspilerVisitor::visitFunctionCall(JBLangParser::FunctionCallCon
         return code;
     }
 
+    // Arguments the callee only borrows are kept alive by the caller's own
+    // references, so they are passed without counting.
+    auto callee = m_typeSystem->getFunction(funcName);
+    auto borrowed = [&callee](size_t i) {
+        return callee && i<callee->borrowedParams.size() && callee->borrowedParams[i];
+    };
+
     if (ctx->argumentList()) {
         args.reserve(ctx->argumentList()->expression().size());
-        for (auto arg : ctx->argumentList()->expression()) {
-            auto argString = std::any_cast<std::string>(visit(arg));
+        for (size_t i = 0; i<ctx->argumentList()->expression().size(); ++i) {
+            auto argString = std::any_cast<std::string>(visit(ctx->argumentList()->expression(i)));
 
             Variable assignedFrom;
             bool found = m_symbolTable->lookupSymbol(argString, assignedFrom);
-            if (this->addRefCounts && found && assignedFrom.type.isPointer()) {
-                pointerArgs = true;
-                m_output << indentLevel << m_codeGen->generateIncRef(assignedFrom);
+            if (this->addRefCounts && found && assignedFrom.type.isPointer() && !borrowed(i)) {
+                // Only a call with counts to drop after it is a statement of its own.
+                std::string increment = m_codeGen->generateIncRef(assignedFrom);
+                pointerArgs = pointerArgs || !increment.empty();
+                m_output << indentLevel << increment;
             }
 
             args.emplace_back(argString);
@@ -465,12 +720,12 @@ antlrcpp::Any TranspilerVisitor::visitFunctionCall(JBLangParser::FunctionCallCon
 
     if (this->addRefCounts && ctx->argumentList()) {
         args.reserve(ctx->argumentList()->expression().size());
-        for (auto arg : ctx->argumentList()->expression()) {
-            auto argString = std::any_cast<std::string>(visit(arg));
+        for (size_t i = 0; i<ctx->argumentList()->expression().size(); ++i) {
+            auto argString = std::any_cast<std::string>(visit(ctx->argumentList()->expression(i)));
 
             Variable assignedFrom;
             bool found = m_symbolTable->lookupSymbol(argString, assignedFrom);
-            if (found && assignedFrom.type.isPointer()) {
+            if (found && assignedFrom.type.isPointer() && !borrowed(i)) {
                 code += indentLevel+m_codeGen->generateDecRef(assignedFrom);
             }
         }
@@ -522,7 +777,10 @@ antlrcpp::Any TranspilerVisitor::visitStructDecl(JBLangParser::StructDeclContext
 {
     Type structType = getStructFromCode(ctx);
     if (!m_first_pass) {
-        m_output << m_codeGen->generateStructDecl(structType.getStructName(), structType);
+        m_output << m_codeGen->generateStructDecl(structType.getStructName(), structType) << ";\n";
+        m_output << m_codeGen->generateTypeDescriptor(structType.getStructName(),
+                m_typeSystem->getPointerFields(structType.getStructName()),
+                m_typeSystem->getCountedFields(structType.getStructName()));
     }
     return nullptr;
 }
@@ -575,6 +833,82 @@ std::string TranspilerVisitor::generateParentConstructorCall(JBLangParser::Class
     return "";
 }
 
+bool TranspilerVisitor::resolveMemberType(const std::string& expr, Type& type)
+{
+    Variable var;
+    if (m_symbolTable->lookupSymbol(expr, var)) {
+        type = var.type;
+        return true;
+    }
+
+    size_t pos = expr.rfind("->");
+    if (pos==std::string::npos) {
+        return false;
+    }
+
+    Type holderType;
+    if (!resolveMemberType(expr.substr(0, pos), holderType) || !holderType.isPointer()) {
+        return false;
+    }
+
+    std::string fieldName = expr.substr(pos+2);
+    fieldName = fieldName.substr(0, fieldName.find('['));
+    try {
+        auto structType = m_typeSystem->resolveType(holderType.getStructName());
+        for (const auto& member : structType.getStructMembers()) {
+            if (member.first==fieldName) {
+                type = member.second;
+                return true;
+            }
+        }
+    }
+    catch (const std::runtime_error&) {
+        // Not a struct or class we know about
+    }
+    return false;
+}
+
+// A counted pointer an expression reads: a variable, or a field reached
+// through one. Whoever keeps what it reads takes a reference of its own.
+bool TranspilerVisitor::lookupCountedPointer(const std::string& expr, Variable& var)
+{
+    if (m_symbolTable->lookupSymbol(expr, var)) {
+        return var.type.isPointer();
+    }
+
+    Type fieldType;
+    if (expr.find("->")==std::string::npos || !resolveMemberType(expr, fieldType) || !fieldType.isPointer()
+            || fieldType.getBaseType()==Type::BaseType::String) {
+        return false;
+    }
+    var = Variable(expr, fieldType);
+    return true;
+}
+
+// Whether an assignment stores into a heap object, through a pointer, rather
+// than into a local or a global, or a struct held in one.
+bool TranspilerVisitor::isHeapSlot(JBLangParser::ExpressionContext* target)
+{
+    if (dynamic_cast<JBLangParser::PointerMemberExprContext*>(target)
+            || dynamic_cast<JBLangParser::DereferenceExprContext*>(target)) {
+        return true;
+    }
+    if (auto member = dynamic_cast<JBLangParser::MemberExprContext*>(target)) {
+        return isHeapSlot(member->expression());
+    }
+    if (auto element = dynamic_cast<JBLangParser::ArrayAccessExprContext*>(target)) {
+        Variable array;
+        if (m_symbolTable->lookupSymbol(element->expression(0)->getText(), array)) {
+            return !array.type.isArray();
+        }
+        return isHeapSlot(element->expression(0));
+    }
+    if (auto primary = dynamic_cast<JBLangParser::PrimaryExprContext*>(target)) {
+        return primary->primary()->expression() && isHeapSlot(primary->primary()->expression());
+    }
+    return false;
+}
+
 std::string TranspilerVisitor::resolveFieldAccess(const std::string& fieldName, const std::string& className)
 {
     auto classType = m_typeSystem->resolveType(className);
@@ -613,6 +947,8 @@ antlrcpp::Any TranspilerVisitor::visitClassDecl(JBLangParser::ClassDeclContext*
             m_output << "    " << member.second.toString() << " " << member.first << ";\n";
         }
         m_output << "};\n\n";
+        m_output << m_codeGen->generateTypeDescriptor(className, m_typeSystem->getPointerFields(className),
+                m_typeSystem->getCountedFields(className));
     }
 
     for (auto member : ctx->classMember()) {
@@ -989,6 +1325,11 @@ antlrcpp::Any TranspilerVisitor::visitTypedefDecl(JBLangParser::TypedefDeclConte
     }
     else {
         m_output << m_codeGen->generateTypeDef(ctx->IDENTIFIER()->getText(), type);
+        if (ctx->structDecl()) {
+            m_output << m_codeGen->generateTypeDescriptor(type.getStructName(),
+                    m_typeSystem->getPointerFields(type.getStructName()),
+                    m_typeSystem->getCountedFields(type.getStructName()));
+        }
     }
 
     return nullptr;
@@ -1062,6 +1403,10 @@ antlrcpp::Any TranspilerVisitor::visitInitializerList(JBLangParser::InitializerL
         bool found = m_symbolTable->lookupSymbol(assignExpr, assignedFrom);
         if (found && assignedFrom.type.isPointer()) {
             m_output << indentLevel+m_codeGen->generateIncRef(assignedFrom);
+            std::string barrier = m_codeGen->generateWriteBarrier("", assignExpr);
+            if (!barrier.empty()) {
+                m_output << indentLevel+barrier;
+            }
         }
         code += indentLevel+"."+initializer->IDENTIFIER()->getText()+" = "+assignExpr+",\n";
     }
@@ -102,14 +102,105 @@ std::string CCodeGenerator::generateScopeExit(const std::map<std::string, Variab
     return "}\n";
 }
 
+std::string CCodeGenerator::generateTypeDescriptor(const std::string& typeName,
+        const std::vector<std::string>& pointerFields, const std::vector<std::string>& countedFields)
+{
+    if (!m_useTypeDescriptors) {
+        return "";
+    }
+
+    // Drops exactly the references the object holds, however many there are.
+    std::string release;
+    if (m_useRefCounts && !countedFields.empty()) {
+        release = "static void "+typeName+"_release(void* object)\n{\n";
+        release += "    struct "+typeName+"* self = object;\n";
+        for (const auto& field : countedFields) {
+            release += "    runtime_dec_ref_count(self->"+field+", 0);\n";
+        }
+        release += "}\n";
+    }
+    std::string releaseInit = release.empty() ? "" : ", 0, "+typeName+"_release";
+
+    // A counting allocator follows the offsets to find cycles, so they leave
+    // out strings just as release does.
+    const auto& traced = m_useRefCounts ? countedFields : pointerFields;
+    std::string descriptor = "static TypeDescriptor "+typeName+"_descriptor = ";
+    if (traced.empty()) {
+        return descriptor+"{0, NULL};\n\n";
+    }
+
+    std::string offsets = "static const size_t "+typeName+"_pointer_offsets[] = {";
+    for (size_t i = 0; i<traced.size(); ++i) {
+        if (i>0) {
+            offsets += ", ";
+        }
+        offsets += "offsetof(struct "+typeName+", "+traced[i]+")";
+    }
+    offsets += "};\n";
+    return release+offsets+descriptor+"{"+std::to_string(traced.size())+", "+typeName+"_pointer_offsets"+releaseInit
+            +"};\n\n";
+}
+
 std::string CCodeGenerator::generateAlloc(const Type& type)
 {
-    return "runtime_alloc(sizeof("+type.toString()+"))";
+    // Pointers and arrays are left for the collector to scan conservatively.
+    if (!m_useTypeDescriptors || type.isPointer() || type.isArray()) {
+        return "runtime_alloc(sizeof("+type.toString()+"))";
+    }
+    if (type.isStruct() || type.isClass()) {
+        return "runtime_alloc_typed(sizeof("+type.toString()+"), &"+type.getStructName()+"_descriptor)";
+    }
+    return "runtime_alloc_typed(sizeof("+type.toString()+"), &runtime_pointer_free)";
 }
 
-std::string CCodeGenerator::generateIncRef(const Variable& var, const std::string& other)
+std::string CCodeGenerator::generateRootTable(const std::vector<GlobalRoot>& roots)
 {
-    if (!m_useRefCounts) {
+    if (roots.empty()) {
+        return "";
+    }
+
+    std::string offsets;
+    std::string table = "static const RootEntry global_roots[] = {\n";
+    for (const auto& root : roots) {
+        std::string offsetsName = "NULL";
+        if (!root.pointerOffsets.empty()) {
+            offsetsName = root.name+"_root_offsets";
+            offsets += "static const size_t "+offsetsName+"[] = {";
+            for (size_t i = 0; i<root.pointerOffsets.size(); ++i) {
+                if (i>0) {
+                    offsets += ", ";
+                }
+                offsets += root.pointerOffsets[i];
+            }
+            offsets += "};\n";
+        }
+        table += "    {&"+root.name+", "+std::to_string(root.pointerCount)+", "+offsetsName+"},\n";
+    }
+    return offsets+table+"};\n\n";
+}
+
+std::string CCodeGenerator::generateRootRegistration(const std::vector<GlobalRoot>& roots)
+{
+    if (roots.empty()) {
+        return "";
+    }
+    return "runtime_register_roots(global_roots, "+std::to_string(roots.size())+");\n";
+}
+
+std::string CCodeGenerator::generateRuntimeSetup()
+{
+    if (!m_deferLocalRefCounts) {
+        return "";
+    }
+    // main's own frame is the bottom of every one the stack scan looks at.
+    return "runtime_set_stack_bottom(__builtin_frame_address(0));\n"
+           "runtime_set_gc_mode(GC_MODE_DEFERRED);\n";
+}
+
+std::string CCodeGenerator::generateIncRef(const Variable& var, const std::string& other, bool heapSlot)
+{
+    // Locals and globals are found by reconciliation instead.
+    if (!m_useRefCounts || (m_deferLocalRefCounts && !heapSlot)) {
         return "";
     }
 
@@ -117,9 +208,9 @@ std::string CCodeGenerator::generateIncRef(const Variable& var, const std::strin
     return code+");\n";
 }
 
-std::string CCodeGenerator::generateDecRef(const Variable& var)
+std::string CCodeGenerator::generateDecRef(const Variable& var, bool heapSlot)
 {
-    if (!m_useRefCounts) {
+    if (!m_useRefCounts || (m_deferLocalRefCounts && !heapSlot)) {
         return "";
     }
 
@@ -133,6 +224,24 @@ std::string CCodeGenerator::generateDecRef(const Variable& var)
     return code+");\n";
 }
 
+std::string CCodeGenerator::generateStoreRef(const std::string& field, const std::string& object)
+{
+    if (!m_deferLocalRefCounts) {
+        return "";
+    }
+    return "runtime_inc_ref_count("+field+", "+object+")";
+}
+
+std::string CCodeGenerator::generateWriteBarrier(const std::string& field, const std::string& value)
+{
+    if (!m_useWriteBarriers) {
+        return "";
+    }
+
+    std::string slot = field.empty() ? "NULL" : "&"+field;
+    return "runtime_write_barrier("+slot+", "+value+");\n";
+}
+
 std::string CCodeGenerator::generateCast(const std::string& expr, const Type& fromType, const Type& toType)
 {
     if (fromType.isPointer() && toType.isPointer() &&
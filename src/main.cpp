@@ -28,10 +28,23 @@ bool compileCode(const std::string& cFilePath, const std::string& outputPath,
     if (debug) {
         buildRuntime += " DEBUG=1";
     }
+    // The program sees the same allocator flags as the runtime, so that
+    // reference counts can be updated inline, and is optimized so that they
+    // are.
+    std::string allocatorFlags;
+    if (allocatorType=="reference_count" || allocatorType=="reference_count_deferred") {
+        allocatorFlags = " -O2 -DUSE_REF_COUNT";
+    }
+    else if (allocatorType=="reference_count_compact") {
+        allocatorFlags = " -O2 -DUSE_REF_COUNT -DRC_COMPACT_HEADER";
+    }
+    if (debug) {
+        allocatorFlags += " -DDEBUG";
+    }
     std::string compileCommand = "cd ../build && gcc -o "+outputPath+" "+
             cFilePath+" "+
             "../runtime/lib/libjblang_runtime.a "+
-            "-I ../runtime/include";
+            "-I ../runtime/include -pthread"+allocatorFlags;
 
     std::cout << "Cleaning runtime..." << std::endl;
     if (system(cleanRuntime.c_str())!=0) {
@@ -55,7 +68,8 @@ bool compileCode(const std::string& cFilePath, const std::string& outputPath,
 void printUsage(const char* programName)
 {
     std::cerr << "Usage: " << programName << " <input-file> -o <output-name> [-a <allocator>] [--debug]\n";
-    std::cerr << "Allocators: simple, reference_count, mark_sweep\n";
+    std::cerr << "Allocators: simple, reference_count, reference_count_compact, reference_count_deferred,"
+                 " mark_sweep\n";
 }
 
 int main(int argc, char* argv[])
@@ -90,7 +104,8 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    if (allocatorType!="simple" && allocatorType!="reference_count" && allocatorType!="mark_sweep") {
+    if (allocatorType!="simple" && allocatorType!="reference_count" && allocatorType!="reference_count_compact"
+            && allocatorType!="reference_count_deferred" && allocatorType!="mark_sweep") {
         std::cerr << "Error: Invalid allocator type: " << allocatorType << std::endl;
         printUsage(argv[0]);
         return 1;
@@ -118,10 +133,16 @@ int main(int argc, char* argv[])
         antlr4::CommonTokenStream tokens(&lexer);
         JBLangParser parser(&tokens);
 
-        bool useRefCount = (allocatorType=="reference_count");
+        // Deferred counting leaves locals to a scan of the stack.
+        bool deferRefCounts = (allocatorType=="reference_count_deferred");
+        bool useRefCount = (allocatorType=="reference_count" || allocatorType=="reference_count_compact"
+                || deferRefCounts);
+        bool useWriteBarriers = (allocatorType=="mark_sweep");
+        bool useTypeDescriptors = (allocatorType=="mark_sweep" || useRefCount);
 
         auto* tree = parser.program();
-        std::unique_ptr<CodeGenerator> generator = std::make_unique<CCodeGenerator>(useRefCount);
+        std::unique_ptr<CodeGenerator> generator = std::make_unique<CCodeGenerator>(useRefCount, useWriteBarriers,
+                useTypeDescriptors, deferRefCounts);
         TranspilerVisitor visitor(std::move(generator));
         auto cCode = std::any_cast<std::string>(visitor.visitProgram(tree));
 
@@ -154,6 +154,12 @@ void TypeSystem::registerFunction(std::shared_ptr<Function> func)
     m_funcs[func->name] = std::move(func);
 }
 
+std::shared_ptr<Function> TypeSystem::getFunction(const std::string& name) const
+{
+    auto it = m_funcs.find(name);
+    return it!=m_funcs.end() ? it->second : nullptr;
+}
+
 Type TypeSystem::registerClass(const std::string& name)
 {
     Type type(Type::BaseType::Class);
@@ -257,6 +263,76 @@ std::vector<std::pair<std::string, Type>> TypeSystem::getAllClassMembers(const s
     return allMembers;
 }
 
+std::vector<std::string> TypeSystem::getPointerFields(const std::string& name) const
+{
+    return collectPointerFields(name, true);
+}
+
+std::vector<std::string> TypeSystem::getCountedFields(const std::string& name) const
+{
+    return collectPointerFields(name, false);
+}
+
+std::vector<std::string> TypeSystem::collectPointerFields(const std::string& name, bool includeStrings) const
+{
+    std::vector<std::string> fields;
+
+    auto classIt = m_classes.find(name);
+    if (classIt!=m_classes.end()) {
+        if (classIt->second.hasParent()) {
+            for (const auto& field : collectPointerFields(classIt->second.getParentClass(), includeStrings)) {
+                fields.push_back("parent."+field);
+            }
+        }
+        for (const auto& member : classIt->second.getStructMembers()) {
+            collectPointerFields(member.first, member.second, includeStrings, fields);
+        }
+        return fields;
+    }
+
+    auto structIt = m_structs.find(name);
+    if (structIt==m_structs.end()) {
+        throw CompilerError(CompilerError::ErrorType::TypeError, "Struct not found: "+name);
+    }
+    for (const auto& member : structIt->second.getStructMembers()) {
+        collectPointerFields(member.first, member.second, includeStrings, fields);
+    }
+    return fields;
+}
+
+void TypeSystem::collectPointerFields(const std::string& path, const Type& type, bool includeStrings,
+        std::vector<std::string>& fields) const
+{
+    // Arrays are expanded into one path per element.
+    std::vector<std::string> paths{path};
+    if (type.isArray()) {
+        for (int size : type.getArraySizes()) {
+            std::vector<std::string> indexed;
+            for (const auto& prefix : paths) {
+                for (int i = 0; i<size; ++i) {
+                    indexed.push_back(prefix+"["+std::to_string(i)+"]");
+                }
+            }
+            paths = std::move(indexed);
+        }
+    }
+
+    if (type.isPointer()) {
+        if (!includeStrings && type.getBaseType()==Type::BaseType::String) {
+            return;
+        }
+        fields.insert(fields.end(), paths.begin(), paths.end());
+    }
+    else if (type.isStruct() || type.isClass()) {
+        auto nested = collectPointerFields(type.getStructName(), includeStrings);
+        for (const auto& prefix : paths) {
+            for (const auto& field : nested) {
+                fields.push_back(prefix+"."+field);
+            }
+        }
+    }
+}
+
 std::vector<std::shared_ptr<Function>> TypeSystem::getVirtualMethods(const std::string& className) const
 {
     std::vector<std::shared_ptr<Function>> virtualMethods;
@@ -12,6 +12,8 @@ struct Point {
     int y;
 };
 
+static TypeDescriptor Point_descriptor = {0, NULL};
+
 void Point_Point(struct Point* this, int nx, int ny) {
 {
         this->x = nx;
@@ -26,12 +28,12 @@ int Point_distance_squared(struct Point* this){
         return this->x * this->x + this->y * this->y;
         }
 void Point_move(struct Point* this, int dx, int dy){
-                this->x = this->x + dx;
-                this->y = this->y + dy;
+        this->x = this->x + dx;
+        this->y = this->y + dy;
         }
 
 int main_(){
-        struct Point* temp_0 = runtime_alloc(sizeof(struct Point));
+        struct Point* temp_0 = runtime_alloc_typed(sizeof(struct Point), &Point_descriptor);
         Point_Point(temp_0, 3, 4);
         struct Point* p = temp_0;
         Point_print(p);
@@ -39,8 +41,8 @@ int main_(){
                 printf("Distance squared: %d\n", dist);
         Point_move(p, 1, 1);
         Point_print(p);
-                return 0;
-                }
+        return 0;
+        }
 
 int main() {
     runtime_init();
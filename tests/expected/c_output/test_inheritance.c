@@ -30,6 +30,8 @@ struct Animal {
     int age;
 };
 
+static TypeDescriptor Animal_descriptor = {0, NULL};
+
 void Animal_Animal(struct Animal* this, int a) {
     this->vtable = &Animal_vtable;
 {
@@ -56,6 +58,8 @@ struct Dog {
     int breed_id;
 };
 
+static TypeDescriptor Dog_descriptor = {0, NULL};
+
 void Dog_Dog(struct Dog* this, int a, int b) {
     Animal_Animal(&(this->parent), a);
     (this->parent).vtable = &Dog_vtable;
@@ -83,6 +87,8 @@ struct Cat {
     int lives;
 };
 
+static TypeDescriptor Cat_descriptor = {0, NULL};
+
 void Cat_Cat(struct Cat* this, int a) {
     Animal_Animal(&(this->parent), a);
     (this->parent).vtable = &Cat_vtable;
@@ -104,10 +110,10 @@ void Cat_purr(struct Cat* this){
 
 int main_(){
                 printf("=== Animal Inheritance Test ===\n");
-        struct Dog* temp_0 = runtime_alloc(sizeof(struct Dog));
+        struct Dog* temp_0 = runtime_alloc_typed(sizeof(struct Dog), &Dog_descriptor);
         Dog_Dog(temp_0, 3, 42);
         struct Dog* dog = temp_0;
-        struct Cat* temp_1 = runtime_alloc(sizeof(struct Cat));
+        struct Cat* temp_1 = runtime_alloc_typed(sizeof(struct Cat), &Cat_descriptor);
         Cat_Cat(temp_1, 2);
         struct Cat* cat = temp_1;
                 printf("\n--- Dog Tests ---\n");
@@ -122,7 +128,7 @@ int main_(){
         Cat_purr(cat);
                 printf("Cat age: %d\n", Animal_getAge(&((cat)->parent)));
                 printf("\n--- Parent Method Calls ---\n");
-        struct Animal* temp_2 = runtime_alloc(sizeof(struct Animal));
+        struct Animal* temp_2 = runtime_alloc_typed(sizeof(struct Animal), &Animal_descriptor);
         Animal_Animal(temp_2, 5);
         struct Animal* animal = temp_2;
         animal->vtable->speak(animal);
@@ -131,8 +137,8 @@ int main_(){
                 printf("\n--- Non virtual method call on upcast ---\n");
                 animal = &((dog)->parent);
         animal->vtable->speak(animal);
-                                return 0;
-                                }
+        return 0;
+        }
 
 int main() {
     runtime_init();
@@ -20,17 +20,21 @@ typedef struct link {
 	struct link* next;
 	int value;
 } link;
+static const size_t link_pointer_offsets[] = {offsetof(struct link, next)};
+static TypeDescriptor link_descriptor = {1, link_pointer_offsets};
+
 
 bool is_nil(struct link* x){
         return x == NULL;
         }
 
 struct link* cons(int car, struct link* cdr){
-        struct link* new_link = runtime_alloc(sizeof(struct link));
-                new_link->next = cdr;
+        struct link* new_link = runtime_alloc_typed(sizeof(struct link), &link_descriptor);
+                runtime_write_barrier(&new_link->next, cdr);
+        new_link->next = cdr;
         new_link->value = car;
-                        return new_link;
-                }
+        return new_link;
+        }
 
 void print_list(struct link* x){
                 printf("[");
@@ -66,11 +70,9 @@ struct link* reverse(struct link* x, struct link* acc){
 
 int main_(){
         struct link* my_list1 =         cons(1, NIL);
-                struct link* my_list2 =         cons(2, my_list1);
-        ;
-                        print_list(my_list2);
-        ;
-                        }
+                struct link* my_list2 =         cons(2, my_list1)        ;
+                        print_list(my_list2)        ;
+        }
 
 int main() {
     runtime_init();
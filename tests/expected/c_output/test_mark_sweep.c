@@ -22,27 +22,37 @@ typedef struct Node {
 	struct Node* next;
 	struct Node* child;
 } Node;
+static const size_t Node_pointer_offsets[] = {offsetof(struct Node, next), offsetof(struct Node, child)};
+static TypeDescriptor Node_descriptor = {2, Node_pointer_offsets};
+
 
 typedef struct Graph {
 	struct Node* nodes[5];
 	int count;
 } Graph;
+static const size_t Graph_pointer_offsets[] = {offsetof(struct Graph, nodes[0]), offsetof(struct Graph, nodes[1]), offsetof(struct Graph, nodes[2]), offsetof(struct Graph, nodes[3]), offsetof(struct Graph, nodes[4])};
+static TypeDescriptor Graph_descriptor = {5, Graph_pointer_offsets};
+
 
 struct Node* create_node(int val){
-        struct Node* n = runtime_alloc(sizeof(struct Node));
+        struct Node* n = runtime_alloc_typed(sizeof(struct Node), &Node_descriptor);
         n->value = val;
+        runtime_write_barrier(&n->next, NULL);
         n->next = NIL;
+        runtime_write_barrier(&n->child, NULL);
         n->child = NIL;
-                        return n;
-                }
+        return n;
+        }
 
 void test_basic_collection(){
                 printf("=== Basic Collection Test ===\n");
         struct Node* temp1 =         create_node(100);
         struct Node* temp2 =         create_node(200);
         struct Node* temp3 =         create_node(300);
-                temp1->next = temp2;
-                temp2->next = temp3;
+                runtime_write_barrier(&temp1->next, temp2);
+        temp1->next = temp2;
+                runtime_write_barrier(&temp2->next, temp3);
+        temp2->next = temp3;
                 printf("Created temporary chain: %d -> %d -> %d\n", temp1->value, temp2->value, temp3->value);
         struct Node* keeper =         create_node(999);
                 printf("Created keeper node: %d\n", keeper->value);
@@ -55,16 +65,19 @@ void test_basic_collection(){
                 printf("Keeper still accessible: %d\n", keeper->value);
                 runtime_gc();
                 printf("Garbage collection completed\n");
-                                        }
+        }
 
 void test_reachable_cycles(){
                 printf("\n=== Reachable Cycle Test ===\n");
         struct Node* a =         create_node(1);
         struct Node* b =         create_node(2);
         struct Node* c =         create_node(3);
-                a->next = b;
-                b->next = c;
-                c->next = a;
+                runtime_write_barrier(&a->next, b);
+        a->next = b;
+                runtime_write_barrier(&b->next, c);
+        b->next = c;
+                runtime_write_barrier(&c->next, a);
+        c->next = a;
                 printf("Created cycle: %d -> %d -> %d -> (back to %d)\n", a->value, b->value, c->value, a->value);
                 b = NIL;
                 c = NIL;
@@ -76,7 +89,7 @@ void test_reachable_cycles(){
                 printf("Broke reference to cycle\n");
                 runtime_gc();
                 printf("GC run - cycle should be collected now\n");
-                                }
+        }
 
 void test_partial_structures(){
                 printf("\n=== Partial Structure Collection Test ===\n");
@@ -85,22 +98,27 @@ void test_partial_structures(){
         struct Node* branch2 =         create_node(3);
         struct Node* leaf1 =         create_node(4);
         struct Node* leaf2 =         create_node(5);
-                root->next = branch1;
-                root->child = branch2;
-                branch1->child = leaf1;
-                branch2->child = leaf2;
+                runtime_write_barrier(&root->next, branch1);
+        root->next = branch1;
+                runtime_write_barrier(&root->child, branch2);
+        root->child = branch2;
+                runtime_write_barrier(&branch1->child, leaf1);
+        branch1->child = leaf1;
+                runtime_write_barrier(&branch2->child, leaf2);
+        branch2->child = leaf2;
                 printf("Built tree: root(%d) -> branch1(%d) -> leaf1(%d)\n", root->value, branch1->value, leaf1->value);
                 printf("           root(%d) -> branch2(%d) -> leaf2(%d)\n", root->value, branch2->value, leaf2->value);
                 branch1 = NIL;
                 branch2 = NIL;
                 leaf1 = NIL;
                 leaf2 = NIL;
+        runtime_write_barrier(&root->child, NULL);
         root->child = NIL;
                 printf("Cut off branch2 subtree\n");
                 runtime_gc();
                 printf("GC should collect branch2(%d) and leaf2(%d)\n", 2, 5);
                 printf("Root and branch1 subtree still reachable: %d -> %d -> %d\n", root->value, root->next->value, root->next->child->value);
-                                                }
+        }
 
 void test_gc_threshold(){
                 printf("\n=== GC Threshold Test ===\n");
@@ -112,7 +130,7 @@ void test_gc_threshold(){
                 printf("Keeper should still be alive: %d\n", keeper->value);
                 runtime_gc();
                 printf("Final GC completed\n");
-                }
+        }
 
     struct Node* global_node = NIL;
 
@@ -136,9 +154,13 @@ int main_(){
         return 0;
         }
 
+static const RootEntry global_roots[] = {
+    {&global_node, 1, NULL},
+};
+
 int main() {
     runtime_init();
-    runtime_register_root(&global_node);
+    runtime_register_roots(global_roots, 1);
     main_();
     runtime_shutdown();
 }
@@ -18,20 +18,35 @@ typedef struct Node {
 	int value;
 	struct Node* child;
 } Node;
+static void Node_release(void* object)
+{
+    struct Node* self = object;
+    runtime_dec_ref_count(self->child, 0);
+}
+static const size_t Node_pointer_offsets[] = {offsetof(struct Node, child)};
+static TypeDescriptor Node_descriptor = {1, Node_pointer_offsets, 0, Node_release};
+
 
 typedef struct Container {
 	struct Node* primary;
 	struct Node* backup;
 } Container;
+static void Container_release(void* object)
+{
+    struct Container* self = object;
+    runtime_dec_ref_count(self->primary, 0);
+    runtime_dec_ref_count(self->backup, 0);
+}
+static const size_t Container_pointer_offsets[] = {offsetof(struct Container, primary), offsetof(struct Container, backup)};
+static TypeDescriptor Container_descriptor = {2, Container_pointer_offsets, 0, Container_release};
+
 
 struct Node* create_node(int val){
-        struct Node* n = runtime_alloc(sizeof(struct Node));
+        struct Node* n = runtime_alloc_typed(sizeof(struct Node), &Node_descriptor);
         n->value = val;
+        runtime_dec_ref_count(n->child, 0);
         n->child = NIL;
-        runtime_inc_ref_count(n, NULL);
-        runtime_dec_ref_count(n, 0);
         return n;
-        runtime_dec_ref_count(n, 0);
         }
 
 void test_basic_sharing(){
@@ -44,12 +59,12 @@ void test_basic_sharing(){
                 printf("Shared node value: %d\n", shared->value);
                 printf("Ref1 value: %d\n", ref1->value);
                 printf("Ref2 value: %d\n", ref2->value);
+        runtime_dec_ref_count(ref2, 0);
         runtime_dec_ref_count(ref1, 0);
         ref1 =         create_node(100);
                 printf("After reassignment, ref1 value: %d\n", ref1->value);
-                printf("Shared still: %d\n", shared->value);
         runtime_dec_ref_count(ref1, 0);
-        runtime_dec_ref_count(ref2, 0);
+                printf("Shared still: %d\n", shared->value);
         runtime_dec_ref_count(shared, 0);
         }
 
@@ -58,34 +73,41 @@ void test_nested_structures(){
         struct Node* parent =         create_node(1);
         struct Node* child =         create_node(2);
         runtime_inc_ref_count(child, parent);
+        runtime_dec_ref_count(parent->child, 0);
         parent->child = child;
                 printf("Parent: %d, Child: %d\n", parent->value, parent->child->value);
         struct Node* parent2 =         create_node(3);
         runtime_inc_ref_count(child, parent2);
+        runtime_dec_ref_count(parent2->child, 0);
         parent2->child = child;
                 printf("Parent2: %d, Shared child: %d\n", parent2->value, parent2->child->value);
+        runtime_dec_ref_count(parent->child, 0);
         parent->child = NIL;
+        runtime_dec_ref_count(parent, 0);
                 printf("After nullifying parent->child, parent2 child still: %d\n", parent2->child->value);
         runtime_dec_ref_count(child, 0);
-        runtime_dec_ref_count(parent, 0);
         runtime_dec_ref_count(parent2, 0);
         }
 
 void test_container_patterns(){
                 printf("\n=== Container Pattern Test ===\n");
-        struct Container* box = runtime_alloc(sizeof(struct Container));
+        struct Container* box = runtime_alloc_typed(sizeof(struct Container), &Container_descriptor);
         struct Node* important_data =         create_node(999);
         runtime_inc_ref_count(important_data, box);
+        runtime_dec_ref_count(box->primary, 0);
         box->primary = important_data;
         runtime_inc_ref_count(important_data, box);
+        runtime_dec_ref_count(box->backup, 0);
         box->backup = important_data;
+        runtime_dec_ref_count(important_data, 0);
                 printf("Primary: %d, Backup: %d\n", box->primary->value, box->backup->value);
+        runtime_dec_ref_count(box->primary, 0);
         box->primary = NIL;
                 printf("After removing primary, backup still: %d\n", box->backup->value);
+        runtime_dec_ref_count(box->primary, 0);
         box->primary =         create_node(777);
                 printf("New primary: %d, Backup: %d\n", box->primary->value, box->backup->value);
         runtime_dec_ref_count(box, 0);
-        runtime_dec_ref_count(important_data, 0);
         }
 
 int main_(){
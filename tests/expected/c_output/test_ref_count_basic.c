@@ -10,18 +10,21 @@ struct vtable {
 typedef struct Node {
 	int data;
 } Node;
+static TypeDescriptor Node_descriptor = {0, NULL};
+
 
 int main_(){
-        struct Node* n = runtime_alloc(sizeof(struct Node));
+        struct Node* n = runtime_alloc_typed(sizeof(struct Node), &Node_descriptor);
         n->data = 5;
         runtime_inc_ref_count(n, NULL);
         struct Node* x = n;
         runtime_inc_ref_count(n, NULL);
         runtime_dec_ref_count(x, 0);
         x = n;
+        x = x;
+        runtime_dec_ref_count(x, 0);
                 printf("data: %d\n", n->data);
         runtime_dec_ref_count(n, 0);
-        runtime_dec_ref_count(x, 0);
         }
 
 int main() {
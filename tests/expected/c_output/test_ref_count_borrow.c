@@ -0,0 +1,90 @@
+#include "runtime.h"
+#include<stdio.h>
+
+#define NIL 0
+
+
+
+
+
+
+
+struct vtable {
+};
+
+
+typedef struct Account {
+	int balance;
+	struct Account* partner;
+} Account;
+static void Account_release(void* object)
+{
+    struct Account* self = object;
+    runtime_dec_ref_count(self->partner, 0);
+}
+static const size_t Account_pointer_offsets[] = {offsetof(struct Account, partner)};
+static TypeDescriptor Account_descriptor = {1, Account_pointer_offsets, 0, Account_release};
+
+
+int balance_of(struct Account* account){
+        return account->balance;
+        }
+
+int combined(struct Account* first, struct Account* second){
+        return         balance_of(first) +         balance_of(second);
+        }
+
+void link(struct Account* account, struct Account* partner){
+        runtime_inc_ref_count(partner, account);
+        runtime_dec_ref_count(account->partner, 0);
+        account->partner = partner;
+        }
+
+struct Account* pick(struct Account* first, struct Account* second){
+        if (        balance_of(first) >         balance_of(second)) {
+{
+            runtime_inc_ref_count(first, NULL);
+            return first;
+            }
+}
+        runtime_inc_ref_count(second, NULL);
+        return second;
+        }
+
+int main_(){
+        struct Account* savings = runtime_alloc_typed(sizeof(struct Account), &Account_descriptor);
+        struct Account* checking = runtime_alloc_typed(sizeof(struct Account), &Account_descriptor);
+        savings->balance = 100;
+        checking->balance = 50;
+        int total = 0;
+        int days = 0;
+        while (days < 10) {
+{
+            total = total +             combined(savings, checking);
+            days = days + 1;
+            }
+}
+                printf("Total over %d days: %d\n", days, total);
+        runtime_inc_ref_count(checking, NULL);
+                link(savings, checking);
+        runtime_dec_ref_count(checking, 0);
+;
+                printf("Partner: %d\n",         balance_of(savings->partner));
+        runtime_inc_ref_count(savings, NULL);
+        runtime_inc_ref_count(checking, NULL);
+        struct Account* richer =         pick(savings, checking);
+        runtime_dec_ref_count(savings, 0);
+        runtime_dec_ref_count(checking, 0);
+;
+        runtime_dec_ref_count(checking, 0);
+        runtime_dec_ref_count(savings, 0);
+                printf("Richer: %d\n", richer->balance);
+        runtime_dec_ref_count(richer, 0);
+        return 0;
+        }
+
+int main() {
+    runtime_init();
+    main_();
+    runtime_shutdown();
+}
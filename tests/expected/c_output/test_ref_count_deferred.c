@@ -0,0 +1,127 @@
+#include "runtime.h"
+#include<stdio.h>
+
+#define NIL 0
+
+
+
+
+
+
+
+
+
+
+
+struct vtable {
+};
+
+
+typedef struct Node {
+	int value;
+	struct Node* next;
+} Node;
+static void Node_release(void* object)
+{
+    struct Node* self = object;
+    runtime_dec_ref_count(self->next, 0);
+}
+static const size_t Node_pointer_offsets[] = {offsetof(struct Node, next)};
+static TypeDescriptor Node_descriptor = {1, Node_pointer_offsets, 0, Node_release};
+
+
+struct Node* create_node(int val){
+        struct Node* n = runtime_alloc_typed(sizeof(struct Node), &Node_descriptor);
+        n->value = val;
+        runtime_dec_ref_count(n->next, 0);
+        n->next = NIL;
+        return n;
+        }
+
+struct Node* push(struct Node* head, int val){
+        struct Node* node =         create_node(val);
+        runtime_inc_ref_count(head, node);
+        runtime_dec_ref_count(node->next, 0);
+        node->next = head;
+        return node;
+        }
+
+typedef struct Registry {
+	struct Node* first;
+} Registry;
+static void Registry_release(void* object)
+{
+    struct Registry* self = object;
+    runtime_dec_ref_count(self->first, 0);
+}
+static const size_t Registry_pointer_offsets[] = {offsetof(struct Registry, first)};
+static TypeDescriptor Registry_descriptor = {1, Registry_pointer_offsets, 0, Registry_release};
+
+
+    struct Node* kept = NIL;
+
+    struct Registry registry;
+
+void keep(int val){
+                kept =         create_node(val);
+        registry.first =         create_node(val + 1);
+        }
+
+void litter(int count){
+        int i = 0;
+        while (i < count) {
+{
+                        create_node(i);
+            i = i + 1;
+            }
+}
+        }
+
+int sum(struct Node* head){
+        int total = 0;
+                struct Node* current = head;
+        while (current != NIL) {
+{
+            total = total + current->value;
+                                    current = current->next;
+            }
+}
+        return total;
+        }
+
+int main_(){
+        struct Node* list = NIL;
+        int i = 0;
+        while (i < 100) {
+{
+                                    list =             push(list, i)            ;
+            i = i + 1;
+            }
+}
+                                printf("Sum: %d\n",         sum(list)        );
+        struct Node* holder =         create_node(1000);
+        runtime_dec_ref_count(holder->next, 0);
+        holder->next =         create_node(7), runtime_inc_ref_count(holder->next, holder);
+                printf("Held: %d, next: %d\n", holder->value, holder->next->value);
+                list = NIL;
+                printf("Dropped the list\n");
+                keep(42);
+                litter(5000);
+                printf("Kept: %d, registered: %d\n", kept->value, registry.first->value);
+        return 0;
+        }
+
+static const size_t registry_root_offsets[] = {offsetof(struct Registry, first)};
+static const RootEntry global_roots[] = {
+    {&kept, 1, NULL},
+    {&registry, 1, registry_root_offsets},
+};
+
+int main() {
+    runtime_init();
+    runtime_set_stack_bottom(__builtin_frame_address(0));
+    runtime_set_gc_mode(GC_MODE_DEFERRED);
+    runtime_register_roots(global_roots, 2);
+    main_();
+    runtime_shutdown();
+}
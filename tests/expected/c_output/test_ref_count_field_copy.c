@@ -0,0 +1,46 @@
+#include "runtime.h"
+#include<stdio.h>
+
+#define NIL 0
+
+
+
+struct vtable {
+};
+
+
+typedef struct Node {
+	int value;
+	struct Node* child;
+} Node;
+static void Node_release(void* object)
+{
+    struct Node* self = object;
+    runtime_dec_ref_count(self->child, 0);
+}
+static const size_t Node_pointer_offsets[] = {offsetof(struct Node, child)};
+static TypeDescriptor Node_descriptor = {1, Node_pointer_offsets, 0, Node_release};
+
+
+int main_(){
+        struct Node* a = runtime_alloc_typed(sizeof(struct Node), &Node_descriptor);
+        struct Node* b = runtime_alloc_typed(sizeof(struct Node), &Node_descriptor);
+        runtime_dec_ref_count(b->child, 0);
+        b->child = runtime_alloc_typed(sizeof(struct Node), &Node_descriptor);
+        b->child->value = 7;
+        runtime_inc_ref_count(b->child, a);
+        runtime_dec_ref_count(a->child, 0);
+        a->child = b->child;
+        runtime_dec_ref_count(b->child, 0);
+        b->child = NIL;
+        runtime_dec_ref_count(b, 0);
+                printf("Shared: %d\n", a->child->value);
+        runtime_dec_ref_count(a, 0);
+        return 0;
+        }
+
+int main() {
+    runtime_init();
+    main_();
+    runtime_shutdown();
+}
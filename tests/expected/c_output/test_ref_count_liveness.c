@@ -0,0 +1,63 @@
+#include "runtime.h"
+#include<stdio.h>
+
+
+
+
+
+struct vtable {
+};
+
+
+typedef struct Buffer {
+	int length;
+	int data[60];
+} Buffer;
+static TypeDescriptor Buffer_descriptor = {0, NULL};
+
+
+struct Buffer* make_buffer(int length){
+        struct Buffer* buffer = runtime_alloc_typed(sizeof(struct Buffer), &Buffer_descriptor);
+        buffer->length = length;
+        return buffer;
+        }
+
+int process(int n){
+        struct Buffer* scratch =         make_buffer(n);
+        int length = scratch->length;
+        runtime_dec_ref_count(scratch, 0);
+        struct Buffer* result =         make_buffer(length * 2);
+        int total = result->length;
+        runtime_dec_ref_count(result, 0);
+        struct Buffer* header =         make_buffer(4);
+        if (total > 10) {
+{
+                        printf("Header: %d\n", header->length);
+            runtime_dec_ref_count(header, 0);
+            struct Buffer* body =             make_buffer(total);
+                        printf("Body: %d\n", body->length);
+            runtime_dec_ref_count(body, 0);
+            }
+}
+        else {
+{
+            runtime_dec_ref_count(header, 0);
+            struct Buffer* small =             make_buffer(1);
+                        printf("Small: %d\n", small->length);
+            runtime_dec_ref_count(small, 0);
+            }
+}
+        return total;
+        }
+
+int main_(){
+                printf("Large: %d\n",         process(20));
+                printf("Small: %d\n",         process(2));
+        return 0;
+        }
+
+int main() {
+    runtime_init();
+    main_();
+    runtime_shutdown();
+}
@@ -0,0 +1,78 @@
+#include "runtime.h"
+#include<stdio.h>
+
+#define NIL 0
+
+
+
+
+
+
+struct vtable {
+};
+
+
+typedef struct Node {
+	int value;
+	struct Node* next;
+} Node;
+static void Node_release(void* object)
+{
+    struct Node* self = object;
+    runtime_dec_ref_count(self->next, 0);
+}
+static const size_t Node_pointer_offsets[] = {offsetof(struct Node, next)};
+static TypeDescriptor Node_descriptor = {1, Node_pointer_offsets, 0, Node_release};
+
+
+struct Node* create_node(int val){
+        struct Node* n = runtime_alloc_typed(sizeof(struct Node), &Node_descriptor);
+        n->value = val;
+        runtime_dec_ref_count(n->next, 0);
+        n->next = NIL;
+        return n;
+        }
+
+int value_if_positive(int flag){
+        struct Node* n =         create_node(flag * 10);
+        if (flag > 0) {
+{
+            int temp_0 = n->value;
+            runtime_dec_ref_count(n, 0);
+            return temp_0;
+            }
+}
+        runtime_dec_ref_count(n, 0);
+        return 0;
+        }
+
+struct Node* second(int val){
+        struct Node* head =         create_node(val);
+        runtime_dec_ref_count(head->next, 0);
+        head->next =         create_node(val + 1);
+        if (val > 0) {
+{
+            struct Node* temp_1 = head->next;
+            runtime_inc_ref_count(temp_1, NULL);
+            runtime_dec_ref_count(head, 0);
+            return temp_1;
+            }
+}
+        runtime_dec_ref_count(head, 0);
+        return NIL;
+        }
+
+int main_(){
+                printf("Value: %d\n",         value_if_positive(4));
+                printf("Value: %d\n",         value_if_positive(0));
+        struct Node* n =         second(7);
+                printf("Second: %d\n", n->value);
+        runtime_dec_ref_count(n, 0);
+        return 0;
+        }
+
+int main() {
+    runtime_init();
+    main_();
+    runtime_shutdown();
+}
@@ -11,6 +11,8 @@ typedef struct Point {
 	int x;
 	int y;
 } Point;
+static TypeDescriptor Point_descriptor = {0, NULL};
+
 
 int main_(){
         struct Point p;
@@ -18,7 +20,7 @@ int main_(){
         p.x = 10;
         pp->y = 20;
         int* ip = &p.x;
-                *ip = 30;
+        *ip = 30;
         if (p.x > 20) {
 {
             }
@@ -33,7 +35,7 @@ int main_(){
             p.x = p.x - 7;
             }
 }
-                        }
+        }
 
 int main() {
     runtime_init();
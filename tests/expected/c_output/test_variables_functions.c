@@ -9,15 +9,14 @@ struct vtable {
 
 
 void add_in_place(int a, int b, int* c){
-                *c = a + b;
+        *c = a + b;
         }
 
 int add(int a, int b){
-        int* c = runtime_alloc(sizeof(int));
-                        add_in_place(a, b, c);
-        ;
-                return *c;
-                }
+        int* c = runtime_alloc_typed(sizeof(int), &runtime_pointer_free);
+                add_in_place(a, b, c);
+        return *c;
+        }
 
 int main_(){
         int x = 5;
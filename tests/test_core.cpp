@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 #include "jblang/types/TypeSystem.h"
 #include "jblang/codegen/CCodeGenerator.h"
+#include "jblang/types/SymbolTable.h"
 
 TEST(CoreTest, TypeResolution)
 {
@@ -69,8 +70,142 @@ TEST(CoreTest, AllocationGen)
     Type structType(Type::BaseType::Struct);
     structType.setStruct("Point");
     auto result2 = gen.generateAlloc(structType);
-    EXPECT_EQ(result2, "runtime_alloc(sizeof(Point))");
+    EXPECT_EQ(result2, "runtime_alloc(sizeof(struct Point))");
 
     auto result3 = gen.generateFunctionCall("printf", {"\"hello\""});
     EXPECT_EQ(result3, "printf(\"hello\")");
-}
\ No newline at end of file
+}
+
+TEST(CoreTest, WriteBarrierGen)
+{
+    CCodeGenerator gen(false);
+    EXPECT_EQ(gen.generateWriteBarrier("n->next", "m"), "");
+
+    CCodeGenerator barrierGen(false, true);
+    EXPECT_EQ(barrierGen.generateWriteBarrier("n->next", "m"), "runtime_write_barrier(&n->next, m);\n");
+    EXPECT_EQ(barrierGen.generateWriteBarrier("", "m"), "runtime_write_barrier(NULL, m);\n");
+}
+
+TEST(CoreTest, TypeDescriptorGen)
+{
+    TypeSystem ts;
+    ts.registerStruct("Point");
+    ts.setStructMembers("Point", {{"x", ts.resolveType("int")}, {"y", ts.resolveType("int")}});
+    ts.registerStruct("Node");
+    ts.setStructMembers("Node", {{"next", ts.resolveType("Node*")}, {"pos", ts.resolveType("Point")},
+                                 {"name", ts.resolveType("string")}});
+    ts.registerClass("Tree");
+    Type children = ts.resolveType("Node*");
+    children.setArray("children", {2});
+    ts.setClassMembers("Tree", {{"children", children}});
+    ts.registerClass("Forest");
+    ts.setClassParent("Forest", "Tree");
+    ts.setClassMembers("Forest", {{"size", ts.resolveType("int")}});
+
+    EXPECT_TRUE(ts.getPointerFields("Point").empty());
+    EXPECT_EQ(ts.getPointerFields("Node"), (std::vector<std::string>{"next", "name"}));
+    EXPECT_EQ(ts.getPointerFields("Forest"),
+            (std::vector<std::string>{"parent.children[0]", "parent.children[1]"}));
+
+    CCodeGenerator gen(false);
+    EXPECT_EQ(gen.generateTypeDescriptor("Node", ts.getPointerFields("Node")), "");
+
+    CCodeGenerator typedGen(false, true, true);
+    EXPECT_EQ(typedGen.generateTypeDescriptor("Point", {}), "static TypeDescriptor Point_descriptor = {0, NULL};\n\n");
+    EXPECT_EQ(typedGen.generateTypeDescriptor("Node", ts.getPointerFields("Node")),
+            "static const size_t Node_pointer_offsets[] = {offsetof(struct Node, next), offsetof(struct Node, name)};\n"
+            "static TypeDescriptor Node_descriptor = {2, Node_pointer_offsets};\n\n");
+    EXPECT_EQ(typedGen.generateAlloc(ts.resolveType("Node")),
+            "runtime_alloc_typed(sizeof(struct Node), &Node_descriptor)");
+    EXPECT_EQ(typedGen.generateAlloc(ts.resolveType("int")),
+            "runtime_alloc_typed(sizeof(int), &runtime_pointer_free)");
+    EXPECT_EQ(typedGen.generateAlloc(ts.resolveType("Node*")), "runtime_alloc(sizeof(struct Node*))");
+
+    EXPECT_EQ(ts.getCountedFields("Node"), (std::vector<std::string>{"next"}));
+    CCodeGenerator countedGen(true, false, true);
+    EXPECT_EQ(countedGen.generateTypeDescriptor("Node", ts.getPointerFields("Node"), ts.getCountedFields("Node")),
+            "static void Node_release(void* object)\n{\n"
+            "    struct Node* self = object;\n"
+            "    runtime_dec_ref_count(self->next, 0);\n}\n"
+            "static const size_t Node_pointer_offsets[] = {offsetof(struct Node, next)};\n"
+            "static TypeDescriptor Node_descriptor = {1, Node_pointer_offsets, 0, Node_release};\n\n");
+}
+
+TEST(CoreTest, RootTableGen)
+{
+    CCodeGenerator gen(false);
+    EXPECT_EQ(gen.generateRootTable({}), "");
+    EXPECT_EQ(gen.generateRootRegistration({}), "");
+
+    GlobalRoot head;
+    head.name = "head";
+    head.pointerCount = 1;
+    GlobalRoot graph;
+    graph.name = "graph";
+    graph.pointerOffsets = {"offsetof(struct Graph, first)", "offsetof(struct Graph, first)+1*sizeof(struct Graph)"};
+    graph.pointerCount = 2;
+
+    EXPECT_EQ(gen.generateRootTable({head, graph}),
+            "static const size_t graph_root_offsets[] = {offsetof(struct Graph, first), "
+            "offsetof(struct Graph, first)+1*sizeof(struct Graph)};\n"
+            "static const RootEntry global_roots[] = {\n"
+            "    {&head, 1, NULL},\n"
+            "    {&graph, 2, graph_root_offsets},\n"
+            "};\n\n");
+    EXPECT_EQ(gen.generateRootRegistration({head, graph}), "runtime_register_roots(global_roots, 2);\n");
+}
+
+TEST(CoreTest, DeferredRefCountGen)
+{
+    Type nodePtr(Type::BaseType::Struct);
+    nodePtr.setStruct("Node");
+    nodePtr.setPointer(true);
+    Variable local("node", nodePtr);
+    Variable field("list->head", nodePtr);
+
+    CCodeGenerator gen(true);
+    EXPECT_EQ(gen.generateIncRef(local), "runtime_inc_ref_count(node, NULL);\n");
+    EXPECT_EQ(gen.generateStoreRef("list->head", "list"), "");
+    EXPECT_EQ(gen.generateRuntimeSetup(), "");
+
+    CCodeGenerator deferred(true, false, true, true);
+    EXPECT_EQ(deferred.generateIncRef(local), "");
+    EXPECT_EQ(deferred.generateDecRef(local), "");
+    EXPECT_EQ(deferred.generateIncRef(local, "list", true), "runtime_inc_ref_count(node, list);\n");
+    EXPECT_EQ(deferred.generateDecRef(field, true), "runtime_dec_ref_count(list->head, 0);\n");
+    // A global, found by reconciliation as a root, is left uncounted, and a
+    // heap slot is counted however its lvalue is spelled.
+    Variable global("registry.first", nodePtr);
+    Variable element("nodes[i]", nodePtr);
+    EXPECT_EQ(deferred.generateIncRef(local, "NULL", false), "");
+    EXPECT_EQ(deferred.generateDecRef(global), "");
+    EXPECT_EQ(deferred.generateIncRef(local, "NULL", true), "runtime_inc_ref_count(node, NULL);\n");
+    EXPECT_EQ(deferred.generateDecRef(element, true), "runtime_dec_ref_count(nodes[i], 0);\n");
+    EXPECT_EQ(deferred.generateStoreRef("list->head", "list"), "runtime_inc_ref_count(list->head, list)");
+    EXPECT_EQ(deferred.generateRuntimeSetup(), "runtime_set_stack_bottom(__builtin_frame_address(0));\n"
+                                                "runtime_set_gc_mode(GC_MODE_DEFERRED);\n");
+}
+
+TEST(CoreTest, ReleasedLocals)
+{
+    Type nodePtr(Type::BaseType::Struct);
+    nodePtr.setStruct("Node");
+    nodePtr.setPointer(true);
+
+    SymbolTable table;
+    table.enterScope();
+    table.addSymbol("node", nodePtr);
+    table.setReleased("node", true);
+    EXPECT_TRUE(table.isReleased("node"));
+
+    // A shadowing declaration starts out holding its reference.
+    table.enterScope();
+    table.addSymbol("node", nodePtr);
+    EXPECT_FALSE(table.isReleased("node"));
+    table.exitScope();
+    EXPECT_TRUE(table.isReleased("node"));
+
+    table.setReleased("node", false);
+    EXPECT_FALSE(table.isReleased("node"));
+    EXPECT_FALSE(table.isReleased("missing"));
+}